@@ -0,0 +1,28 @@
+#define FEC_MAX_DATA 128 //Most data frames in one erasure coding block
+#define FEC_MAX_PARITY 128 //Most parity frames sent for one block
+#define FEC_HEADER_SIZE 9 //Parity frames carry the number of data frames in their block and their parity index after the 7 byte frame header
+#define FEC_SYMBOL_EXTRA 2 //A symbol is a data frame after its 7 byte frame header, preceded by the 16-bit length of that part
+#define FOUNTAIN_BLOCK 1024 //Most data frames in one fountain coded block
+#define FOUNTAIN_HEADER_SIZE 26 //Fountain frames carry the data frames' file type, the sequence and count of the transfer's data frames, their block and their symbol ID after the 7 byte frame header
+#define FOUNTAIN_C 5 //Robust soliton c of the fountain degree distribution, in hundredths
+#define FOUNTAIN_DELTA_INV 200 //Robust soliton 1/delta of the fountain degree distribution
+#define FOUNTAIN_MARGIN(dataCount) ((dataCount)/64+12) //Fountain symbols beyond the data frame count of a block after which it almost always decodes
+
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+
+uint8_t fecCoefficient(uint8_t parity, uint8_t data);
+
+void gfMulAdd(uint8_t* dst, const uint8_t* src, uint8_t c, uint32_t len);
+
+const char* gfKernelName();
+
+int fecRecover(uint8_t** data, const uint8_t* have, uint8_t dataCount, uint8_t** parity, const uint8_t* parityIndex, uint8_t parityCount, uint32_t symbolSize);
+
+uint16_t fountainNeighbours(uint32_t block, uint32_t symbol, uint16_t dataCount, uint16_t* neighbours);
+
+uint32_t fountainDecode(uint8_t** data, uint8_t* have, uint16_t dataCount, uint8_t** symbols, const uint32_t* symbolId, uint32_t symbolCount, uint32_t block, uint32_t symbolSize);
+
+#endif
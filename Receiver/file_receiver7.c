@@ -8,6 +8,8 @@
 //Version 7 - Added ability for partial video recovery with frame loss in mp4 and mov
 //11/12/2019 update - Added linked-list queue that stores received data to be processed by a separate thread
 
+#define _FILE_OFFSET_BITS 64 //64-bit file offsets for outputs and spill files over 2GB on 32-bit systems
+
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -15,9 +17,19 @@
 #include <time.h>
 #include <inttypes.h>
 #include <pthread.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 
 #include "lodepng.h"
 #include "zlib.h"
+#include "codec.h"
+#include "fec.h"
 
 #include <math.h>
 
@@ -25,113 +37,158 @@
 //#define INTEREST_NAME "Raspberry"
 #define RECV_TIMEOUT 5 //Amount of time(s) between each frame that is allowed to pass before automatically declaring the end of the transmission
 #define BUFFER_SIZE 1024
+#define RING_SLOTS 4096 //Number of preallocated frame slots between recv_frame and the writer thread(must be a power of 2)
+#define SEQUENCE_WINDOW (RING_SLOTS*16) //Furthest a frame's sequence can be past the highest one received before the frame is rejected as corrupt or foreign
+#define CACHE_LINE 64
+#define WRITE_BATCH 256 //Maximum number of frames written to the spill file by a single writev call
+#define MEMORY_BUDGET (64*1024*1024) //Bytes of received frames kept in memory before the rest are spilled to disk
+#define SPILL_DIR "/tmp" //Directory for the spill file, overridden by the VMAC_SPILL_DIR environment variable(a tmpfs mount keeps it off the SD card)
+#define SPILL_WINDOW (64*1024*1024) //Bytes of the spill file mapped at once during reconstruction(must be a multiple of the page size)
+#define FRAME_HEADER_SIZE (3+sizeof(uint32_t)) //Every frame starts with a 3 character file type followed by the sender's 32-bit frame sequence
+#define PNG_WORKERS 2 //Number of threads decompressing PNG frames while the transfer is arriving(0 decompresses everything after the transfer ends)
+#define PNG_JOB_SLOTS 1024 //Number of PNG frames that can wait for a worker thread before the rest are left for after the transfer
+#define PNG_HEADER_SIZE (FRAME_HEADER_SIZE+sizeof(uint16_t)) //PNG frames carry the sender's image ID after the frame header
+#define PNG_META_OFFSET UINT64_MAX //Pixel offset(currSize) marking a PNG metadata frame
+#define PNG_META_HEADER_SIZE (PNG_HEADER_SIZE+sizeof(uint64_t)+2*sizeof(uint32_t)) //Metadata frames carry the metadata size and fragment offset after the pixel offset
 
-FILE *compTemp;
 FILE *timestamps;
 //uint8_t isDone = 0;//Changes to 1 when transmission end statement is received
-uint8_t hasStarted = 0;//Changes to 1 when first data frame is received
 uint8_t firstSeqReceived = 0;
-unsigned int highestSeq = 0, lowestSeq = 0;
-volatile clock_t lastframeTime;
+uint32_t highestSeq = 0, lowestSeq = 0;
+atomic_llong lastframeTime;//Monotonic time(ms) of the most recent frame, 0 until the first frame is received
+atomic_int transferDone;//Set by the writer thread once every block of a fountain coded transfer can be decoded, after which frames are ignored
 unsigned int frameCounter = 1;
 
-//Queue declaration
-struct Queue* queue;
-
 //Multithreading
-pthread_mutex_t lock;
 pthread_t tid;
+int wakeFd;//eventfd recv_frame uses to wake the writer thread when it is asleep
 
 //Timestamp variables
 long ms;
 time_t sec;
 struct timespec spec;
 
-unsigned int receivedSize = 0;
-unsigned int expectedSize = 0;
+uint64_t receivedSize = 0;
+uint64_t expectedSize = 0;
+
+//Fountain symbols of the transfer counted by the writer thread as they arrive, so it can stop waiting once every block
+//holds FOUNTAIN_MARGIN symbols more than it has data frames
+struct fountainProgress
+{
+	uint32_t firstSeq;//Sequence of the transfer's first data frame
+	uint32_t frameCount;//Data frames in the transfer, 0 until the first fountain frame
+	uint32_t* symbols;//Fountain symbols received for each block
+	uint32_t blocksReady;
+}fountain;
 
 struct tempCompData//Struct for received compressed data
 {
-	uint16_t sequence;
+	uint32_t sequence;
 	uint16_t len;
 	char data[BUFFER_SIZE];
 }toWrite;
 
+//Frames are stored as their sequence and len followed by only the len bytes received, padded to keep records aligned
+#define RECORD_SIZE(len) ((offsetof(struct tempCompData,data)+(len)+3)&~(size_t)3)
+
 struct sizeData//Struct for storing currSize variables(variables that store amount of data sent so far)
 {
-	uint16_t sequence;
-	uint32_t size;
+	uint32_t sequence;
+	uint64_t size;
 };
 
-//Queue stuff
-//A linked list (LL) node to store a queue entry 
-struct QNode
+//Frame store: received frames are kept in a memory arena up to MEMORY_BUDGET and spilled to a temporary file after that,
+//and every frame is indexed by its sequence so reconstruction can find it without scanning
+struct frameStore
 {
-    struct tempCompData* data; 
-    struct QNode* next; 
-}; 
-  
-//The queue, front stores the front node of LL and rear stores the last node of LL 
-struct Queue
+	uint64_t* record;//Offset+1 of the first frame received with each sequence, 0 if none was(offsets from MEMORY_BUDGET up are in the spill file)
+	uint32_t slots;//Number of sequences record can hold, grown as higher sequences arrive
+	uint32_t count;//Number of distinct sequences received
+	char* arena;//In-memory records, filled in arrival order
+	uint32_t arenaSize;//Bytes of the arena in use
+	int spillFd;//Spill file for records past the memory budget, -1 until it is needed
+	uint64_t spillSize;//Bytes written to the spill file
+	char* spillMap;//SPILL_WINDOW bytes of the spill file mapped read-only once the transfer has ended, NULL until a spilled frame is read
+	uint64_t spillMapStart;//Offset of spillMap in the spill file
+}store;
+
+//MP4 frame layout: frame header, 64-bit box contents size, box name, then the 64-bit currSize for mdat frames or moovFirst, the ftyp box, and subSeq for moov frames
+#define MP4_NAME_OFFSET (FRAME_HEADER_SIZE+sizeof(uint64_t))
+#define MDAT_HEADER_SIZE (MP4_NAME_OFFSET+4+sizeof(uint64_t))
+#define MOOV_FIRST_OFFSET (MP4_NAME_OFFSET+4)
+
+//General frame layout: frame header, the 64-bit offset of the data in the file, the 32-bit length of the data, the 64-bit file size, then its codec
+#define GEN_HEADER_SIZE (FRAME_HEADER_SIZE+sizeof(uint64_t)+sizeof(uint32_t)+sizeof(uint64_t)+1)
+
+#define NO_FRAME UINT32_MAX //Sequence stored in frameIndex where a frame was lost
+
+//Index of the frames reconstruction needs, built by a single pass over the frame store once the transfer has ended
+//Frames are referred to by sequence since pointers returned by storedFrame do not outlive the next call
+struct frameIndex
 {
-    struct QNode *front, *rear;
-}; 
-  
-//A utility function to create a new linked list node. 
-struct QNode* newNode(struct tempCompData* data) 
-{ 
-    struct QNode* temp = (struct QNode*)malloc(sizeof(struct QNode)); 
-    temp->data = malloc(sizeof(struct tempCompData));
-    memcpy(temp->data, data, sizeof(struct tempCompData));
-    
-    temp->next = NULL; 
-    return temp;
-} 
-  
-//A utility function to create an empty queue 
-struct Queue* createQueue() 
-{ 
-    struct Queue* q = (struct Queue*)malloc(sizeof(struct Queue)); 
-    q->front = q->rear = NULL; 
-    return q; 
-} 
-  
-void enQueue(struct Queue* q, struct tempCompData* data) 
-{ 
-    // Create a new LL node 
-    struct QNode* temp = newNode(data); 
-  
-    // If queue is empty, then new node is front and rear both 
-    if (q->rear == NULL)
-    { 
-		q->front = q->rear = temp; 
-        return; 
-    } 
-  
-    // Add the new node at the end of queue and change rear 
-    q->rear->next = temp; 
-    q->rear = temp; 
-} 
-
-struct tempCompData* deQueue(struct Queue* q) 
-{ 
-    // If queue is empty, return NULL. 
-    if (q->front == NULL) 
-        return NULL;
-  
-    // Store previous front and move front one node ahead 
-    struct QNode* temp = q->front;
-    struct tempCompData* data = temp->data; 
-    free(temp);
-  
-    q->front = q->front->next; 
-  
-    // If front becomes NULL, then change rear also as NULL 
-    if (q->front == NULL) 
-        q->rear = NULL; 
-    return data; 
-}
+	uint32_t* received;//Sequence of every frame received, in sequence order
+	uint32_t receivedCount;
+	struct sizeData* mdat;//mdat frames sorted by the offset(currSize) of their data in the mdat box
+	uint32_t mdatCount;
+	uint32_t* moov;//Sequence of the first moov frame received for each sub sequence, NO_FRAME where every copy was lost
+	uint32_t moovCount;//Highest moov sub sequence received + 1
+	uint32_t moovSlots;//Allocated length of moov
+	uint16_t moovHeaderSize;//Offset of subSeq in every moov frame
+	uint32_t firstMdat;//mdat frame with the lowest sequence
+	uint32_t firstMoov;//moov frame with the lowest sequence
+}frames = {.firstMdat = NO_FRAME, .firstMoov = NO_FRAME};
+
+//Rows of one width the sender packs the image as, the whole image or its 7 Adam7 passes
+struct imagePasses
+{
+	uint8_t count;
+	uint64_t start[8];//Offset of each pass in the image as sent, followed by the image size
+	uint32_t stride[7];//Bytes in each row of each pass
+};
+
+//PNG frames decompressed straight into the image by worker threads while the transfer is still arriving
+struct pngAssembly
+{
+	int started;//0 until the PNG metadata is complete, 1 once the workers are running, -1 if the metadata could not be used
+	unsigned char* image;//Raw pixel data in the order it was sent, zeroed so missing frames leave black pixels
+	uint32_t imageSize;
+	uint32_t stride;//Bytes in each row of the image
+	uint8_t bytesPerPixel;
+	struct imagePasses passes;
+	uint8_t* received;//Set to 1 for each pixel received when the image is sent in Adam7 order, otherwise NULL
+	uint16_t imageId;//Image ID of the first metadata frame, frames with any other ID are ignored
+	unsigned char* meta;//Image format and ancillary chunks, NULL until the first metadata frame
+	uint8_t* metaHave;//Set to 1 for each byte of meta received
+	uint32_t metaSize;
+	uint32_t metaMissing;//Bytes of meta not yet received
+	uint8_t* decoded;//Set to 1 for each sequence already decompressed into image
+	uint32_t decodedSlots;//Number of sequences decoded can hold
+	
+	struct tempCompData* jobs;//Circular buffer of frames waiting for a worker
+	unsigned int jobHead, jobTail;
+	int done;//Set once the transfer has ended so the workers exit after the remaining jobs
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	pthread_t workers[PNG_WORKERS > 0 ? PNG_WORKERS : 1];
+}pngAsm;
+
+struct ringSlot//Frame slot padded out to a whole number of cache lines
+{
+	_Alignas(CACHE_LINE) struct tempCompData frame;
+};
 
+//Single-producer/single-consumer ring of preallocated frames filled by recv_frame and drained by processQueue
+//head and tail sit on separate cache lines so the producer and consumer never write to the same line
+struct frameRing
+{
+	_Alignas(CACHE_LINE) atomic_uint head;//Next slot recv_frame writes to
+	_Alignas(CACHE_LINE) atomic_uint tail;//Next slot processQueue reads from
+	atomic_int sleeping;//1 while processQueue is blocked waiting for frames
+	_Alignas(CACHE_LINE) unsigned int highWater;//Largest number of frames waiting in the ring at once
+	unsigned int dropped;//Frames discarded because the ring was full
+	unsigned int rejected;//Frames discarded because they were longer than a ring slot or their sequence was outside SEQUENCE_WINDOW
+	struct ringSlot slots[RING_SLOTS];
+}ring;
 
 /**
  *  changeEndian  - Change endianness
@@ -158,7 +215,7 @@ uint32_t changeEndian(uint32_t x)
  *	@sequence : Sequence of the data pointed to by buff.
  *	@buff : Pointer to the data to write to the struct.
  */
-void writeCompStruct(struct tempCompData *toWriteStruct, uint16_t length, uint16_t sequence, char* buff)
+void writeCompStruct(struct tempCompData *toWriteStruct, uint16_t length, uint32_t sequence, char* buff)
 {
 	toWriteStruct->sequence = sequence;
 	toWriteStruct->len = length;
@@ -169,109 +226,1660 @@ void writeCompStruct(struct tempCompData *toWriteStruct, uint16_t length, uint16
 }
 
 /**
- *  copyFile  - Copys data from one file to another
+ *  growSequenceTable  - Growable sequence table
  *
- *  Copies srcSize bytes of data from the src file to the current file stream location of the dest file through a 1024 byte data buffer.
+ *  Reallocates table so it can hold entry sequence, at least doubling its size and zeroing the new entries.
+ *	Exits if the memory cannot be allocated.
  *	
  *	Arguments :
- *	@dest : Destination file's pointer. Must be opened with write permissions.
- *	@src : Source file's pointer. Must be opened with read permissions.
- *	@srcSize : Number of bytes to be copied from the source file.
+ *	@table : Pointer to the table to grow.
+ *	@slots : Pointer to the number of entries table holds, updated to the new size.
+ *	@entrySize : Size of each entry in bytes.
+ *	@sequence : Sequence the table must be able to hold, below NO_FRAME.
  */
-void copyFile(FILE* dest,FILE* src,long int srcSize)//Appends all data in src to current file stream location of dest
+void growSequenceTable(void** table, uint32_t* slots, size_t entrySize, uint32_t sequence)
 {
-	char data[BUFFER_SIZE];
+	uint64_t newSlots = *slots > 4096 ? (uint64_t)*slots*2 : 4096;
+	if(newSlots > UINT32_MAX)
+	{
+		newSlots = UINT32_MAX;
+	}
+	if(newSlots <= sequence)
+	{
+		newSlots = (uint64_t)sequence+1;
+	}
+	
+	char* grown = realloc(*table,newSlots*entrySize);
+	if(grown == NULL)
+	{
+		printf("Error! Could not allocate sequence index\n");
+		exit(-1);
+	}
+	memset(&grown[*slots*entrySize],0,(newSlots-*slots)*entrySize);
+	*table = grown;
+	*slots = newSlots;
+}
+
+/**
+ *  initStore  - Frame store setup
+ *
+ *  Reserves the memory arena. Pages are only backed by memory once frames are written to them, and one spare frame
+ *	past the budget keeps fixed-offset header reads from a short final record inside the arena.
+ */
+void initStore()
+{
+	store.spillFd = -1;
+	store.arena = mmap(NULL, (size_t)MEMORY_BUDGET+sizeof(struct tempCompData), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	if(store.arena == MAP_FAILED)
+	{
+		printf("Error! Could not reserve frame memory\n");
+		exit(-1);
+	}
+}
+
+/**
+ *  openSpillFile  - Creates the spill file
+ *
+ *  Creates a uniquely named file in VMAC_SPILL_DIR(or SPILL_DIR) for this session. The file is unlinked straight away
+ *	so it disappears with the process however it exits.
+ */
+void openSpillFile()
+{
+	const char* dir = getenv("VMAC_SPILL_DIR");
+	if(dir == NULL)
+	{
+		dir = SPILL_DIR;
+	}
 	
-	fseek(src,0,SEEK_SET);
+	char path[512];
+	snprintf(path,sizeof(path),"%s/vmacRecv-%ld-XXXXXX",dir,(long)getpid());
+	store.spillFd = mkstemp(path);
+	if(store.spillFd < 0)
+	{
+		printf("Error! Could not open spill file in %s\n",dir);
+		exit(-1);
+	}
+	unlink(path);
+}
+
+/**
+ *  storeFrame  - Frame store insertion
+ *
+ *  Copies the frame into the memory arena while it has room. Once the arena is full the frame is indexed as the next
+ *	spill file record instead and the caller must write it there.
+ *	Only the first copy of a sequence is indexed.
+ *	
+ *	Arguments :
+ *	@frame : Frame taken from the receive ring.
+ *
+ *	Returns the number of bytes the caller must append to the spill file, or 0 if the frame was kept in memory.
+ */
+size_t storeFrame(struct tempCompData* frame)
+{
+	size_t recordSize = RECORD_SIZE(frame->len);
+	uint64_t offset;
 	
-	unsigned int strayBytes = srcSize%BUFFER_SIZE;
-	unsigned int iterations = srcSize/BUFFER_SIZE;
+	if(store.spillFd < 0 && store.arenaSize + recordSize <= MEMORY_BUDGET)
+	{
+		offset = store.arenaSize;
+		memcpy(&store.arena[offset],frame,recordSize);
+		store.arenaSize += recordSize;
+		recordSize = 0;
+	}
+	else
+	{
+		if(store.spillFd < 0)
+		{
+			openSpillFile();
+		}
+		offset = MEMORY_BUDGET + store.spillSize;
+		store.spillSize += recordSize;
+	}
 	
-	for(int x = 0;x <iterations;x++)
+	if(frame->sequence >= store.slots)
+	{
+		growSequenceTable((void**)&store.record,&store.slots,sizeof(uint64_t),frame->sequence);
+	}
+	if(store.record[frame->sequence] == 0)
 	{
-		fread(data,BUFFER_SIZE,1,src);
-		fwrite(data,BUFFER_SIZE,1,dest);
+		store.record[frame->sequence] = offset+1;
+		store.count++;
 	}
-	fread(data,strayBytes,1,src);
-	fwrite(data,strayBytes,1,dest);
+	return recordSize;
 }
 
-void* processQueue(void* queue)
+/**
+ *  storedFrame  - Frame store lookup
+ *
+ *  Returns a pointer to the frame with the given sequence in the arena or the mapped spill file, or NULL if it was never received.
+ *	Spilled frames are read through a SPILL_WINDOW sized mapping that moves as needed, so the returned pointer is only valid
+ *	until the next call. openStore must have been called first.
+ *	
+ *	Arguments :
+ *	@sequence : Sequence of the frame to find. Values outside of the 32-bit sequence range return NULL.
+ */
+struct tempCompData* storedFrame(int64_t sequence)
 {
-  while(1)
-  {
-    pthread_mutex_lock(&lock);
-    struct tempCompData* data = deQueue(queue);
-    pthread_mutex_unlock(&lock); 
+	if(sequence < 0 || sequence >= store.slots || store.record[sequence] == 0)
+	{
+		return NULL;
+	}
+	
+	uint64_t offset = store.record[sequence]-1;
+	if(offset < MEMORY_BUDGET)
+	{
+		return (struct tempCompData*)&store.arena[offset];
+	}
+	
+	offset -= MEMORY_BUDGET;
+	if(store.spillMap == NULL || offset < store.spillMapStart || offset >= store.spillMapStart+SPILL_WINDOW)
+	{
+		if(store.spillMap != NULL)
+		{
+			munmap(store.spillMap, (size_t)SPILL_WINDOW+sizeof(struct tempCompData));
+		}
+		//The window covers one extra frame so a record starting near its end is mapped in full
+		store.spillMapStart = offset - offset%SPILL_WINDOW;
+		store.spillMap = mmap(NULL, (size_t)SPILL_WINDOW+sizeof(struct tempCompData), PROT_READ, MAP_SHARED, store.spillFd, (off_t)store.spillMapStart);
+		if(store.spillMap == MAP_FAILED)
+		{
+			printf("Error! Could not map spill file\n");
+			exit(-1);
+		}
+	}
+	return (struct tempCompData*)&store.spillMap[offset-store.spillMapStart];
+}
 
-    if((clock()/CLOCKS_PER_SEC >= lastframeTime + RECV_TIMEOUT) && data == NULL && hasStarted == 1)
-    {
-      return NULL;
-    }
+/**
+ *  openStore  - Prepares the spill file for reading
+ *
+ *  Extends the spill file by one zeroed frame so fixed-offset header reads from a short final record stay inside the file
+ *	when storedFrame maps it.
+ */
+void openStore()
+{
+	if(store.spillFd < 0)
+	{
+		return;
+	}
+	
+	if(ftruncate(store.spillFd, (off_t)store.spillSize+sizeof(struct tempCompData)) != 0)
+	{
+		printf("Error! Could not extend spill file\n");
+		exit(-1);
+	}
+}
 
-    if(data != NULL)
-    {
-      fwrite(data, sizeof(struct tempCompData), 1, compTemp);
-    }
-  }
+/**
+ *  closeStore  - Frame store cleanup
+ *
+ *  Releases the memory arena and the spill file.
+ */
+void closeStore()
+{
+	munmap(store.arena, (size_t)MEMORY_BUDGET+sizeof(struct tempCompData));
+	free(store.record);
+	if(store.spillFd >= 0)
+	{
+		if(store.spillMap != NULL)
+		{
+			munmap(store.spillMap, (size_t)SPILL_WINDOW+sizeof(struct tempCompData));
+		}
+		close(store.spillFd);
+	}
 }
 
-void vmac_register(void* ptr);
-void del_name(char* interest_name, uint16_t name_len);
-void send_vmac(uint16_t type, uint16_t rate, uint16_t seq, char *buff, uint16_t len, char * interest_name, uint16_t name_len);
+/**
+ *  compareSizeData  - qsort comparison for sizeData
+ *
+ *  Orders by size, then by sequence.
+ */
+int compareSizeData(const void* a, const void* b)
+{
+	const struct sizeData* x = a;
+	const struct sizeData* y = b;
+	if(x->size != y->size)
+	{
+		return x->size < y->size ? -1 : 1;
+	}
+	return x->sequence < y->sequence ? -1 : (x->sequence > y->sequence);
+}
 
 /**
- *  recv_frame  - Receives and stores data frames
+ *  boxHeaderSize  - Size of an MP4 box header
  *
- *  Writes data length, frame sequence, and data buffer to a struct and writes that struct to a file. 
- *	Also does comparisons to find the range of sequences, records the time of the frame, and writes formatted timestamps to a separate file.
+ *  Returns the header length writeBoxHeader uses for a box, 16 bytes when the box needs a 64-bit size and 8 otherwise.
+ *	
+ *	Arguments :
+ *	@size : Size of the box contents.
+ */
+uint8_t boxHeaderSize(uint64_t size)
+{
+	return (size > UINT32_MAX-(sizeof(uint32_t)+4) ? sizeof(uint32_t)+4+sizeof(uint64_t) : sizeof(uint32_t)+4);
+}
+
+/**
+ *  writeBoxHeader  - Writes an MP4 box header
  *
- *	No processing of the received data is done other than writing it to a file.
+ *  Writes the big-endian size and name of a box, using a size of 1 followed by a 64-bit largesize for boxes over 4GB.
+ *	
+ *	Arguments :
+ *	@file : File to write to.
+ *	@name : 4 character box name.
+ *	@size : Size of the box contents.
  */
-void recv_frame(uint8_t type, uint64_t enc, char * buff, uint16_t len, uint16_t seq,char* interest_name, uint16_t interest_name_len)
-{	
-	if(type==1 /*&& isDone == 0*/)
+void writeBoxHeader(FILE* file, const char* name, uint64_t size)
+{
+	uint64_t boxSize = size+boxHeaderSize(size);
+	uint32_t size32 = changeEndian(boxHeaderSize(size) > sizeof(uint32_t)+4 ? 1 : boxSize);
+	fwrite(&size32,sizeof(size32),1,file);
+	fwrite(name,4,1,file);
+	if(boxHeaderSize(size) > sizeof(uint32_t)+4)
 	{
-		//printf("seq: %u\n",seq);
-		/*
-		char buffer[len+1];
-		memcpy(buffer,buff,len);
+		uint32_t sizeHalves[2] = {changeEndian(boxSize>>32),changeEndian(boxSize)};
+		fwrite(sizeHalves,sizeof(sizeHalves),1,file);
+	}
+}
+
+/**
+ *  indexMoovFrame  - Adds a moov frame to the frame index
+ *
+ *  Records the frame as the copy of its sub sequence if no other copy has been indexed, growing the sub sequence table as needed.
+ *	
+ *	Arguments :
+ *	@frame : moov frame from the frame store.
+ *	@sequence : Sequence of frame.
+ */
+void indexMoovFrame(struct tempCompData* frame, uint32_t sequence)
+{
+	uint32_t subSeq;
+	
+	if(frames.firstMoov == NO_FRAME)
+	{
+		char chunkName[4];
+		uint32_t ftypSize = 0;
+		
+		frames.moovHeaderSize = MOOV_FIRST_OFFSET + sizeof(uint8_t);
+		memcpy(chunkName,&frame->data[frames.moovHeaderSize+sizeof(ftypSize)],4);
+		if(memcmp(chunkName,"ftyp",4)==0)
+		{
+			memcpy(&ftypSize,&frame->data[frames.moovHeaderSize],sizeof(ftypSize));
+			frames.moovHeaderSize += changeEndian(ftypSize);
+		}
+		frames.firstMoov = sequence;
+	}
+	if(frame->len < frames.moovHeaderSize + sizeof(subSeq))
+	{
+		return;
+	}
+	
+	memcpy(&subSeq,&frame->data[frames.moovHeaderSize],sizeof(subSeq));
+	if(subSeq > store.count)//More sub sequences than frames received, so the frame is corrupt
+	{
+		return;
+	}
+	if(subSeq >= frames.moovSlots)
+	{
+		uint32_t oldSlots = frames.moovSlots;
+		growSequenceTable((void**)&frames.moov,&frames.moovSlots,sizeof(uint32_t),subSeq);
+		for(uint32_t x = oldSlots;x<frames.moovSlots;x++)
+		{
+			frames.moov[x] = NO_FRAME;
+		}
+	}
+	if(frames.moov[subSeq] == NO_FRAME)
+	{
+		frames.moov[subSeq] = sequence;
+	}
+	if(subSeq >= frames.moovCount)
+	{
+		frames.moovCount = subSeq+1;
+	}
+}
+
+/**
+ *  buildFrameIndex  - Frame classification pass
+ *
+ *  Walks the frame store once in sequence order and sorts every frame into the tables of frameIndex, so each stage of
+ *	reconstruction reads only the frames it needs. openStore must have been called first.
+ */
+void buildFrameIndex()
+{
+	frames.received = malloc((store.count+1)*sizeof(uint32_t));
+	frames.mdat = malloc((store.count+1)*sizeof(struct sizeData));
+	if(frames.received == NULL || frames.mdat == NULL)
+	{
+		printf("Error! Could not allocate frame index\n");
+		exit(-1);
+	}
+	
+	uint8_t sorted = 1;//mdat frames are normally sent in currSize order, so sorting is skipped unless one is out of place
+	for(uint64_t seq = lowestSeq;seq<=highestSeq;seq++)
+	{
+		struct tempCompData* frame = storedFrame(seq);
+		if(frame == NULL || memcmp(frame->data,"FEC",3) == 0 || memcmp(frame->data,"LTC",3) == 0)//Parity and fountain frames have been used by recoverFrames and recoverFountain
+		{
+			continue;
+		}
+		frames.received[frames.receivedCount++] = seq;
+		
+		if(frame->len < MDAT_HEADER_SIZE || memcmp(frame->data,"MP4",3) != 0)
+		{
+			continue;
+		}
+		if(memcmp(&frame->data[MP4_NAME_OFFSET],"mdat",4)==0)
+		{
+			struct sizeData* entry = &frames.mdat[frames.mdatCount];
+			entry->sequence = seq;
+			memcpy(&entry->size,&frame->data[MDAT_HEADER_SIZE-sizeof(uint64_t)],sizeof(entry->size));
+			if(frames.mdatCount > 0 && entry->size < frames.mdat[frames.mdatCount-1].size)
+			{
+				sorted = 0;
+			}
+			frames.mdatCount++;
+			
+			if(frames.firstMdat == NO_FRAME)
+			{
+				frames.firstMdat = seq;
+			}
+		}
+		else if(memcmp(&frame->data[MP4_NAME_OFFSET],"moov",4)==0)
+		{
+			indexMoovFrame(frame,seq);
+		}
+	}
+	
+	if(!sorted)
+	{
+		qsort(frames.mdat,frames.mdatCount,sizeof(struct sizeData),compareSizeData);
+	}
+}
+
+/**
+ *  storeRebuiltFrame  - Adds a rebuilt frame to the frame store
+ *
+ *  Turns an erasure coding symbol back into the frame it was made from and stores it as if it had been received, writing
+ *	it to the spill file straight away if the arena is full.
+ *	
+ *	Arguments :
+ *	@fileType : File type of the transfer.
+ *	@sequence : Sequence of the frame.
+ *	@symbol : The frame's 16-bit length after the frame header followed by those bytes, at most BUFFER_SIZE-FRAME_HEADER_SIZE.
+ */
+void storeRebuiltFrame(const char* fileType, uint32_t sequence, const uint8_t* symbol)
+{
+	uint16_t dataLen;
+	memcpy(&dataLen,symbol,sizeof(dataLen));
+	toWrite.sequence = sequence;
+	toWrite.len = FRAME_HEADER_SIZE+dataLen;
+	memcpy(toWrite.data,fileType,3);
+	memcpy(&toWrite.data[3],&toWrite.sequence,sizeof(toWrite.sequence));
+	memcpy(&toWrite.data[FRAME_HEADER_SIZE],&symbol[sizeof(dataLen)],dataLen);
+	
+	size_t spillSize = storeFrame(&toWrite);
+	if(spillSize != 0 && pwrite(store.spillFd,&toWrite,spillSize,(off_t)(store.spillSize-spillSize)) != (ssize_t)spillSize)
+	{
+		printf("Error! Could not write to temporary file\n");
+		exit(-1);
+	}
+	if(toWrite.sequence < lowestSeq)
+	{
+		lowestSeq = toWrite.sequence;
+	}
+}
+
+/**
+ *  recoverFrames  - Rebuilds lost frames from parity frames
+ *
+ *  Finds the erasure coding block of each parity frame from its sequence, as the sender sends a block's parity frames straight
+ *	after its data frames. The lost data frames of each block are solved for from its parity frames and added to the frame store
+ *	as if they had been received. openStore must have been called first and is called again for frames added to the spill file.
+ */
+void recoverFrames()
+{
+	uint8_t* symbols = malloc((size_t)(FEC_MAX_DATA+FEC_MAX_PARITY)*BUFFER_SIZE);
+	if(symbols == NULL)
+	{
+		printf("Error! Could not allocate erasure decoder\n");
+		exit(-1);
+	}
+	uint8_t* data[FEC_MAX_DATA];
+	uint8_t* parity[FEC_MAX_PARITY];
+	uint8_t have[FEC_MAX_DATA];
+	uint8_t parityIndex[FEC_MAX_PARITY];
+	for(int x = 0;x<FEC_MAX_DATA+FEC_MAX_PARITY;x++)
+	{
+		if(x < FEC_MAX_DATA)
+		{
+			data[x] = &symbols[(size_t)x*BUFFER_SIZE];
+		}
+		else
+		{
+			parity[x-FEC_MAX_DATA] = &symbols[(size_t)x*BUFFER_SIZE];
+		}
+	}
+	
+	char fileType[3] = "";//Rebuilt frames get the file type of the transfer
+	for(uint64_t seq = lowestSeq;seq<=highestSeq;seq++)
+	{
+		struct tempCompData* frame = storedFrame(seq);
+		if(frame != NULL && memcmp(frame->data,"FEC",3) != 0 && memcmp(frame->data,"LTC",3) != 0)
+		{
+			memcpy(fileType,frame->data,3);
+			break;
+		}
+	}
+	
+	uint32_t rebuilt = 0, blocksLost = 0;
+	uint64_t nextBlock = 0;//Sequence of the first frame after the last block solved
+	for(uint64_t seq = lowestSeq;seq<=highestSeq;seq++)
+	{
+		struct tempCompData* frame = storedFrame(seq);
+		if(seq < nextBlock || frame == NULL || frame->len <= FEC_HEADER_SIZE || memcmp(frame->data,"FEC",3) != 0)
+		{
+			continue;
+		}
+		uint8_t dataCount = frame->data[FRAME_HEADER_SIZE];
+		uint8_t index = frame->data[FRAME_HEADER_SIZE+1];
+		receivedSize -= frame->len;//Parity bytes are not part of the file
+		if(dataCount == 0 || dataCount > FEC_MAX_DATA || index >= FEC_MAX_PARITY || seq < (uint64_t)dataCount+index)
+		{
+			continue;
+		}
+		uint64_t blockStart = seq-index-dataCount;
+		uint64_t parityStart = blockStart+dataCount;
+		
+		//Every parity frame of the block has the same length, and a frame from any other block ends the search
+		uint8_t parityCount = 0;
+		uint16_t symbolSize = frame->len-FEC_HEADER_SIZE;
+		for(nextBlock = parityStart;nextBlock-parityStart<FEC_MAX_PARITY && nextBlock<=highestSeq;nextBlock++)
+		{
+			frame = storedFrame(nextBlock);
+			if(frame == NULL)
+			{
+				continue;
+			}
+			if(memcmp(frame->data,"FEC",3) != 0 || frame->len != FEC_HEADER_SIZE+symbolSize || frame->data[FRAME_HEADER_SIZE] != dataCount || frame->data[FRAME_HEADER_SIZE+1] != nextBlock-parityStart)
+			{
+				break;
+			}
+			if(nextBlock != seq)
+			{
+				receivedSize -= frame->len;
+			}
+			memcpy(parity[parityCount],&frame->data[FEC_HEADER_SIZE],symbolSize);
+			parityIndex[parityCount] = frame->data[FRAME_HEADER_SIZE+1];
+			parityCount++;
+		}
+		
+		uint8_t lost = 0;
+		for(int x = 0;x<dataCount;x++)
+		{
+			frame = storedFrame(blockStart+x);
+			have[x] = (frame != NULL && frame->len >= FRAME_HEADER_SIZE && frame->len-FRAME_HEADER_SIZE+FEC_SYMBOL_EXTRA <= symbolSize);
+			if(have[x])
+			{
+				uint16_t dataLen = frame->len-FRAME_HEADER_SIZE;
+				memcpy(data[x],&dataLen,sizeof(dataLen));
+				memcpy(&data[x][sizeof(dataLen)],&frame->data[FRAME_HEADER_SIZE],dataLen);
+				memset(&data[x][sizeof(dataLen)+dataLen],0,symbolSize-sizeof(dataLen)-dataLen);
+			}
+			lost += !have[x];
+		}
+		if(lost == 0)
+		{
+			continue;
+		}
+		if(!fecRecover(data,have,dataCount,parity,parityIndex,parityCount,symbolSize))
+		{
+			blocksLost++;
+			continue;
+		}
+		
+		for(int x = 0;x<dataCount;x++)
+		{
+			uint16_t dataLen;
+			memcpy(&dataLen,data[x],sizeof(dataLen));
+			if(have[x] || dataLen+FEC_SYMBOL_EXTRA > symbolSize)
+			{
+				continue;
+			}
+			storeRebuiltFrame(fileType,blockStart+x,data[x]);
+			rebuilt++;
+		}
+	}
+	free(symbols);
+	openStore();
+	
+	if(rebuilt != 0 || blocksLost != 0)
+	{
+		printf("Erasure coding(%s): %u frames rebuilt, %u blocks lost more frames than they had parity for\n",gfKernelName(),rebuilt,blocksLost);
+	}
+}
+
+/**
+ *  recoverFountain  - Decodes the data frames of a fountain coded transfer
+ *
+ *  Gathers the fountain frames of each block, the symbols of the data frames the sender numbered but never sent, and decodes
+ *	the block with fountainDecode. Decoded frames are added to the frame store as if they had been received, and the bytes of
+ *	the fountain frames in receivedSize are swapped for those of the frames decoded from them. openStore must have been
+ *	called first and is called again for frames added to the spill file.
+ */
+void recoverFountain()
+{
+	//Any fountain frame gives the file type, sequences and count of the transfer's data frames
+	struct tempCompData* frame = NULL;
+	for(uint64_t seq = lowestSeq;seq<=highestSeq && frame == NULL;seq++)
+	{
+		frame = storedFrame(seq);
+		if(frame != NULL && (frame->len <= FOUNTAIN_HEADER_SIZE+FEC_SYMBOL_EXTRA || memcmp(frame->data,"LTC",3) != 0))
+		{
+			frame = NULL;
+		}
+	}
+	if(frame == NULL)
+	{
+		return;
+	}
+	char fileType[3];
+	uint32_t firstSeq, frameCount;
+	memcpy(fileType,&frame->data[FRAME_HEADER_SIZE],3);
+	memcpy(&firstSeq,&frame->data[FRAME_HEADER_SIZE+3],sizeof(firstSeq));
+	memcpy(&frameCount,&frame->data[FRAME_HEADER_SIZE+3+sizeof(firstSeq)],sizeof(frameCount));
+	uint32_t symbolSize = frame->len-FOUNTAIN_HEADER_SIZE;
+	uint32_t blockCount = (frameCount+FOUNTAIN_BLOCK-1)/FOUNTAIN_BLOCK;
+	
+	//Sequences of each block's fountain frames, as ranges of one array
+	uint32_t* blockFirst = calloc((size_t)blockCount+1,sizeof(uint32_t));
+	uint32_t* symbolSeq = malloc(((uint64_t)highestSeq-lowestSeq+1)*sizeof(uint32_t));
+	if(blockFirst == NULL || symbolSeq == NULL)
+	{
+		printf("Error! Could not allocate fountain decoder\n");
+		exit(-1);
+	}
+	uint32_t symbolCount = 0;
+	for(int pass = 0;pass<2;pass++)//Counts each block's fountain frames, then fills in their sequences
+	{
+		for(uint64_t seq = lowestSeq;seq<=highestSeq;seq++)
+		{
+			frame = storedFrame(seq);
+			uint32_t frameFirst, frameFrames, block;
+			if(frame == NULL || frame->len != FOUNTAIN_HEADER_SIZE+symbolSize || memcmp(frame->data,"LTC",3) != 0)
+			{
+				continue;
+			}
+			memcpy(&frameFirst,&frame->data[FRAME_HEADER_SIZE+3],sizeof(frameFirst));
+			memcpy(&frameFrames,&frame->data[FRAME_HEADER_SIZE+3+sizeof(frameFirst)],sizeof(frameFrames));
+			memcpy(&block,&frame->data[FRAME_HEADER_SIZE+3+2*sizeof(uint32_t)],sizeof(block));
+			if(frameFirst != firstSeq || frameFrames != frameCount || block >= blockCount)
+			{
+				continue;
+			}
+			if(pass == 0)
+			{
+				blockFirst[block+1]++;
+				receivedSize -= frame->len;
+				symbolCount++;
+			}
+			else
+			{
+				symbolSeq[blockFirst[block]++] = seq;
+			}
+		}
+		
+		if(pass == 0)
+		{
+			for(uint32_t block = 0;block<blockCount;block++)
+			{
+				blockFirst[block+1] += blockFirst[block];
+			}
+		}
+		else
+		{
+			memmove(&blockFirst[1],blockFirst,blockCount*sizeof(uint32_t));//Filling moved each range start to the start of the next
+			blockFirst[0] = 0;
+		}
+	}
+	
+	uint32_t mostSymbols = 0;
+	for(uint32_t block = 0;block<blockCount;block++)
+	{
+		if(blockFirst[block+1]-blockFirst[block] > mostSymbols)
+		{
+			mostSymbols = blockFirst[block+1]-blockFirst[block];
+		}
+	}
+	uint8_t* symbolData = malloc(((size_t)FOUNTAIN_BLOCK+mostSymbols)*symbolSize);
+	uint8_t** data = malloc(((size_t)FOUNTAIN_BLOCK+mostSymbols)*sizeof(uint8_t*));
+	uint8_t** symbols = &data[FOUNTAIN_BLOCK];
+	uint32_t* symbolId = malloc(((size_t)mostSymbols+1)*sizeof(uint32_t));
+	uint8_t have[FOUNTAIN_BLOCK];
+	if(symbolData == NULL || data == NULL || symbolId == NULL)
+	{
+		printf("Error! Could not allocate fountain decoder\n");
+		exit(-1);
+	}
+	for(uint32_t x = 0;x<FOUNTAIN_BLOCK+mostSymbols;x++)
+	{
+		data[x] = &symbolData[(size_t)x*symbolSize];
+	}
+	
+	uint32_t rebuilt = 0, blocksLost = 0;
+	for(uint32_t block = 0;block<blockCount;block++)
+	{
+		uint16_t blockFrames = (frameCount-block*FOUNTAIN_BLOCK < FOUNTAIN_BLOCK ? frameCount-block*FOUNTAIN_BLOCK : FOUNTAIN_BLOCK);
+		uint32_t blockSymbols = blockFirst[block+1]-blockFirst[block];
+		for(uint32_t x = 0;x<blockSymbols;x++)
+		{
+			frame = storedFrame(symbolSeq[blockFirst[block]+x]);
+			memcpy(&symbolId[x],&frame->data[FRAME_HEADER_SIZE+3+3*sizeof(uint32_t)],sizeof(symbolId[x]));
+			memcpy(symbols[x],&frame->data[FOUNTAIN_HEADER_SIZE],symbolSize);
+		}
+		memset(have,0,blockFrames);
+		if(fountainDecode(data,have,blockFrames,symbols,symbolId,blockSymbols,block,symbolSize) != 0)
+		{
+			blocksLost++;
+		}
+		
+		for(uint16_t x = 0;x<blockFrames;x++)
+		{
+			uint16_t dataLen;
+			memcpy(&dataLen,data[x],sizeof(dataLen));
+			if(!have[x] || dataLen+FEC_SYMBOL_EXTRA > symbolSize)
+			{
+				continue;
+			}
+			storeRebuiltFrame(fileType,firstSeq+block*FOUNTAIN_BLOCK+x,data[x]);
+			receivedSize += FRAME_HEADER_SIZE+dataLen;
+			rebuilt++;
+		}
+	}
+	free(symbolData);
+	free(data);
+	free(symbolId);
+	free(blockFirst);
+	free(symbolSeq);
+	free(fountain.symbols);
+	openStore();
+	
+	printf("Fountain coding: %u of %u frames decoded from %u symbols, %u of %u blocks could not be decoded\n",rebuilt,frameCount,symbolCount,blocksLost,blockCount);
+}
+
+/**
+ *  freeFrameIndex  - Frame index cleanup
+ */
+void freeFrameIndex()
+{
+	free(frames.received);
+	free(frames.mdat);
+	free(frames.moov);
+}
+
+/**
+ *  readPngMetadata  - Parses PNG metadata
+ *
+ *  Reads the image format and ancillary chunk data that the sender sends in the PNG metadata frames into state.
+ *	
+ *	Arguments :
+ *	@meta : Metadata reassembled from the metadata frames.
+ *	@metaSize : Length of meta.
+ *	@state : Initialized lodepng state to write the image format and chunk data to.
+ *	@bytesPerPixel : Set to the number of bytes in each pixel.
+ *	@width : Set to the image width in pixels.
+ *	@height : Set to the image height in pixels.
+ *	@interlace : Set to 1 if the pixels are sent in Adam7 order, 0 if they are sent row by row.
+ *
+ *	Returns 1 if the metadata was read, or 0 if it does not end in an IDAT marker or the image would not fit in a 32-bit imageSize.
+ */
+int readPngMetadata(unsigned char* meta, uint32_t metaSize, LodePNGState* state, uint8_t* bytesPerPixel, unsigned* width, unsigned* height, uint8_t* interlace)
+{
+	uint32_t size = 0;
+	uint8_t colortype;
+	
+	if(metaSize < sizeof(*bytesPerPixel)+sizeof(colortype)+sizeof(*width)+sizeof(*height)+sizeof(*interlace)+4)
+	{
+		return 0;
+	}
+	
+	memcpy(bytesPerPixel,&meta[size],sizeof(*bytesPerPixel));
+	//printf("BytesPerPixel: %u\n",*bytesPerPixel);
+	size += sizeof(*bytesPerPixel);
+	
+	memcpy(&colortype,&meta[size],sizeof(colortype));
+	//printf("Colortype: %u\n",colortype);
+	size += sizeof(colortype);
+	if(colortype==0)
+	{
+		state->info_raw.colortype = LCT_GREY;
+	}
+	else if(colortype==2)
+	{
+		state->info_raw.colortype = LCT_RGB;
+	}
+	else if(colortype==3)
+	{
+		state->info_raw.colortype = LCT_PALETTE;
+	}
+	else if(colortype==4)
+	{
+		state->info_raw.colortype = LCT_GREY_ALPHA;
+	}
+	else
+	{
+		state->info_raw.colortype = LCT_RGBA;
+	}
+	
+	state->info_raw.bitdepth = (*bytesPerPixel/(colortype==0?1:(colortype==2?3:(colortype==4?2:4))))*8;
+	
+	memcpy(width,&meta[size],sizeof(*width));
+	//printf("Width: %u\n",*width);
+	size += sizeof(*width);
+	
+	memcpy(height,&meta[size],sizeof(*height));
+	//printf("Height: %u\n",*height);
+	size += sizeof(*height);
+	if(*height != 0 && (uint64_t)*bytesPerPixel*(*width) > UINT32_MAX/(*height))//Checked before anything computes bytesPerPixel*width*height
+	{
+		return 0;
+	}
+	
+	memcpy(interlace,&meta[size],sizeof(*interlace));
+	size += sizeof(*interlace);
+	
+	char chunkName[5];
+	memcpy(&chunkName,&meta[size],4);
+	chunkName[4] = '\0';
+	//printf("First chunk: %s\n",chunkName);
+	
+	const unsigned isPresent = 1;
+	if(strcmp("bKGD",chunkName)==0)
+	{
+		//printf("bkGD Found\n");
+		
+		memcpy(&state->info_png.background_defined,&isPresent,sizeof(state->info_png.background_defined));
+		
+		size += 4;
+		memcpy(&state->info_png.background_r,&meta[size],sizeof(state->info_png.background_r));
+		size += sizeof(state->info_png.background_r);
+		memcpy(&state->info_png.background_g,&meta[size],sizeof(state->info_png.background_g));
+		size += sizeof(state->info_png.background_g);
+		memcpy(&state->info_png.background_b,&meta[size],sizeof(state->info_png.background_b));
+		size += sizeof(state->info_png.background_b);
+		
+		memcpy(&chunkName,&meta[size],4);
+		chunkName[4] = '\0';
+	}
+	if(strcmp("pHYs",chunkName)==0)
+	{
+		//printf("pHYs Found\n");
+		
+		memcpy(&state->info_png.phys_defined,&isPresent,sizeof(state->info_png.phys_defined));
+		
+		size += 4;
+		memcpy(&state->info_png.phys_x,&meta[size],sizeof(state->info_png.phys_x));
+		size += sizeof(state->info_png.phys_x);
+		
+		memcpy(&state->info_png.phys_y,&meta[size],sizeof(state->info_png.phys_y));
+		size += sizeof(state->info_png.phys_y);
+		
+		memcpy(&state->info_png.phys_unit,&meta[size],sizeof(state->info_png.phys_unit));
+		size += sizeof(state->info_png.phys_unit);
+		
+		memcpy(&chunkName,&meta[size],4);
+		chunkName[4] = '\0';
+	}
+	if(strcmp("iCCP",chunkName)==0)
+	{
+		//printf("iCCP Found\n");
+		
+		memcpy(&state->info_png.iccp_defined,&isPresent,sizeof(state->info_png.iccp_defined));
+		
+		size += 4;
+		
+		uint8_t profNameLen;
+		unsigned iccSize;
+		memcpy(&profNameLen,&meta[size],sizeof(profNameLen));
+		size += sizeof(profNameLen);
+		if(size+profNameLen+sizeof(iccSize) > metaSize)
+		{
+			return 0;
+		}
+		char* profName = malloc(profNameLen+1);
+		
+		memcpy(profName,&meta[size],profNameLen);
+		profName[profNameLen] = '\0';
+		size += profNameLen;
+
+		memcpy(&iccSize,&meta[size],sizeof(iccSize));
+		size += sizeof(iccSize);
+		if(iccSize > metaSize-size)
+		{
+			free(profName);
+			return 0;
+		}
+		unsigned char *iccProf = malloc(iccSize);
+		
+		memcpy(iccProf,&meta[size],iccSize);
+		size += iccSize;
+		
+		lodepng_set_icc(&state->info_png,profName,iccProf,iccSize);
+		free(profName);
+		free(iccProf);
+		
+		memcpy(&chunkName,&meta[size],4);
+		chunkName[4] = '\0';
+	}
+	if(strcmp("sRGB",chunkName)==0)
+	{
+		//printf("sRGB Found\n");
+		
+		//Set cHRM & gAMA to sRGB values in case decoder does not use sRGB
+		memcpy(&state->info_png.gama_defined,&isPresent,sizeof(state->info_png.gama_defined));
+		state->info_png.gama_gamma = 45455;
+		memcpy(&state->info_png.chrm_defined,&isPresent,sizeof(state->info_png.chrm_defined));
+		state->info_png.chrm_white_x = 31270;
+		state->info_png.chrm_white_y = 32900;
+		state->info_png.chrm_red_x = 64000;
+		state->info_png.chrm_red_y = 33000;
+		state->info_png.chrm_green_x = 30000;
+		state->info_png.chrm_green_y = 60000;
+		state->info_png.chrm_blue_x = 15000;
+		state->info_png.chrm_blue_y = 6000;
+		
+		memcpy(&state->info_png.srgb_defined,&isPresent,sizeof(state->info_png.srgb_defined));
+		
+		size += 4;
+		memcpy(&state->info_png.srgb_intent,&meta[size],sizeof(state->info_png.srgb_intent));
+		size += sizeof(state->info_png.srgb_intent);
+		
+		memcpy(&chunkName,&meta[size],4);
+		chunkName[4] = '\0';
+	}
+	if(strcmp("cHRM",chunkName)==0)
+	{
+		//printf("cHRM Found\n");
+		
+		memcpy(&state->info_png.chrm_defined,&isPresent,sizeof(state->info_png.chrm_defined));
+		
+		size += 4;
+		memcpy(&state->info_png.chrm_white_x,&meta[size],sizeof(state->info_png.chrm_white_x));
+		size += sizeof(state->info_png.chrm_white_x);
+		
+		memcpy(&state->info_png.chrm_white_y,&meta[size],sizeof(state->info_png.chrm_white_y));
+		size += sizeof(state->info_png.chrm_white_y);
+		
+		memcpy(&state->info_png.chrm_red_x,&meta[size],sizeof(state->info_png.chrm_red_x));
+		size += sizeof(state->info_png.chrm_red_x);
+		
+		memcpy(&state->info_png.chrm_red_y,&meta[size],sizeof(state->info_png.chrm_red_y));
+		size += sizeof(state->info_png.chrm_red_y);
+		
+		memcpy(&state->info_png.chrm_green_x,&meta[size],sizeof(state->info_png.chrm_green_x));
+		size += sizeof(state->info_png.chrm_green_x);
+		
+		memcpy(&state->info_png.chrm_green_y,&meta[size],sizeof(state->info_png.chrm_green_y));
+		size += sizeof(state->info_png.chrm_green_y);
+		
+		memcpy(&state->info_png.chrm_blue_x,&meta[size],sizeof(state->info_png.chrm_blue_x));
+		size += sizeof(state->info_png.chrm_blue_x);
+		
+		memcpy(&state->info_png.chrm_blue_y,&meta[size],sizeof(state->info_png.chrm_blue_y));
+		size += sizeof(state->info_png.chrm_blue_y);
+		
+		memcpy(&chunkName,&meta[size],4);
+		chunkName[4] = '\0';
+	}
+	if(strcmp("gAMA",chunkName)==0)
+	{
+		//printf("gAMA Found\n");
+		
+		memcpy(&state->info_png.gama_defined,&isPresent,sizeof(state->info_png.gama_defined));
+		
+		size += 4;
+		memcpy(&state->info_png.gama_gamma,&meta[size],sizeof(state->info_png.gama_gamma));
+		size += sizeof(state->info_png.gama_gamma);
+		
+		memcpy(&chunkName,&meta[size],4);
+		chunkName[4] = '\0';
+	}
+	
+	if(size+4 > metaSize || strcmp("IDAT",chunkName)!=0)
+	{
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ *  decodeStreams  - Frame payload decompression
+ *
+ *  Decompresses the codec streams that make up the rest of a frame into out, each stream starting straight after the one
+ *	before it. A decompression error is printed and returned so the caller can skip the frame and carry on with the rest.
+ *	
+ *	Arguments :
+ *	@frame : Frame to decompress.
+ *	@start : Offset of the first stream in the frame data.
+ *	@codec : Codec id the frame was sent with.
+ *	@out : Buffer to write to.
+ *	@outSize : Size of out.
+ *	@outLen : Set to the number of bytes decompressed.
+ *
+ *	Returns Z_OK, or the error of the stream that could not be decompressed.
+ */
+int decodeStreams(struct tempCompData* frame, uint16_t start, uint8_t codec, unsigned char* out, uint32_t outSize, uint32_t* outLen)
+{
+	int error = Z_OK;
+	uint32_t inPos = start, outPos = 0;
+	while(inPos < frame->len)
+	{
+		uint32_t inUsed, outUsed;
+		error = codecDecompress(codec,(Bytef *)&frame->data[inPos],frame->len-inPos,&inUsed,&out[outPos],outSize-outPos,&outUsed);
+		if(error != Z_OK)
+		{
+			break;
+		}
+		inPos += inUsed;
+		outPos += outUsed;
+	}
+	
+	if(error != Z_OK)
+	{
+		switch(error)
+		{
+			case Z_MEM_ERROR:
+				printf("Compression Memory Error\n");
+				break;
+
+			case Z_BUF_ERROR:
+				printf("Compression Buffer Error\n");
+				break;
+				
+			case Z_DATA_ERROR:
+				printf("Compression Data Error\n");
+				break;
+				
+			default:
+				printf("Compression Unknown error: %d\n",error);
+				break;
+		}
+	}
+	*outLen = outPos;
+	return error;
+}
+
+/**
+ *  rowAbove  - Row above a row segment
+ *
+ *  Copies the length bytes above the row segment at pos into above, with 0 in place of bytes before start, matching the
+ *	sender which filters every frame without the frames before it.
+ *	
+ *	Arguments :
+ *	@image : Raw pixel buffer.
+ *	@stride : Bytes in each row of the image.
+ *	@start : Offset in the image of the first byte in the frame.
+ *	@pos : Offset in the image of the row segment.
+ *	@length : Length of the row segment.
+ *	@above : Buffer of at least length bytes.
+ */
+void rowAbove(unsigned char* image, uint32_t stride, uint64_t start, uint64_t pos, uint32_t length, unsigned char* above)
+{
+	uint32_t zeros = (pos >= start+stride ? 0 : start+stride-pos);
+	if(zeros > length)
+	{
+		zeros = length;
+	}
+	memset(above,0,zeros);
+	memcpy(&above[zeros],&image[pos+zeros-stride],length-zeros);
+}
+
+/**
+ *  imagePasses  - Pass layout of a PNG image
+ *
+ *  Finds where each pass the sender packed the image as starts in the image as sent, and the row length of each pass.
+ *	
+ *	Arguments :
+ *	@passes : Set to the passes of the image.
+ *	@width : Image width in pixels.
+ *	@height : Image height in pixels.
+ *	@bytesPerPixel : Bytes in each pixel of the image.
+ *	@interlace : 1 if the pixels are sent in Adam7 order, 0 if they are sent row by row.
+ */
+void imagePasses(struct imagePasses* passes, unsigned width, unsigned height, uint8_t bytesPerPixel, uint8_t interlace)
+{
+	if(interlace)
+	{
+		unsigned passw[7], passh[7];
+		size_t passstart[8];
+		lodepng_adam7_passes(passw,passh,passstart,width,height,bytesPerPixel*8);
+		
+		passes->count = 7;
+		for(int x = 0;x<7;x++)
+		{
+			passes->start[x] = passstart[x];
+			passes->stride[x] = bytesPerPixel*passw[x];
+		}
+		passes->start[7] = passstart[7];
+	}
+	else
+	{
+		passes->count = 1;
+		passes->start[0] = 0;
+		passes->start[1] = (uint64_t)bytesPerPixel*width*height;
+		passes->stride[0] = bytesPerPixel*width;
+	}
+}
+
+/**
+ *  decodePngFrame  - PNG frame decompression
+ *
+ *  Decompresses a PNG frame and unfilters its row segments into image from the pixel offset(currSize) carried by the frame.
+ *	Each row segment is its PNG filter type followed by the filtered bytes of the part of the row in the frame. Metadata
+ *	frames and frames of any other image are skipped.
+ *	
+ *	Arguments :
+ *	@frame : PNG frame to decompress.
+ *	@imageId : Image ID of the image being reconstructed.
+ *	@passes : Passes of the image, from imagePasses.
+ *	@image : Raw pixel buffer to write to, in the order the pixels are sent.
+ *	@bytesPerPixel : Bytes in each pixel of the image.
+ *	@received : Set to 1 for each pixel whose last byte is in the frame, or NULL.
+ *	@scratch : FRAME_DATA_MAX + stride bytes of working space.
+ */
+void decodePngFrame(struct tempCompData* frame, uint16_t imageId, struct imagePasses* passes, unsigned char* image, uint8_t bytesPerPixel, uint8_t* received, unsigned char* scratch)
+{
+	uint16_t frameImageId;
+	uint64_t currSize;
+	if(PNG_HEADER_SIZE+sizeof(currSize)+1 >= frame->len)
+	{
+		return;
+	}
+	memcpy(&frameImageId,&frame->data[FRAME_HEADER_SIZE],sizeof(frameImageId));
+	memcpy(&currSize,&frame->data[PNG_HEADER_SIZE],sizeof(currSize));
+	if(frameImageId != imageId || currSize >= passes->start[passes->count])//Metadata frames are skipped here as PNG_META_OFFSET is past any image
+	{
+		return;
+	}
+	//printf("imageSize: %llu currSize %llu\n",passes->start[passes->count],currSize);
+	
+	uint8_t p = 0;
+	while(currSize >= passes->start[p+1])//Frames never span two passes
+	{
+		p++;
+	}
+	uint32_t stride = passes->stride[p];
+	uint64_t passEnd = passes->start[p+1];
+	
+	uint32_t filteredLen;
+	if(decodeStreams(frame,PNG_HEADER_SIZE+sizeof(currSize)+1,frame->data[PNG_HEADER_SIZE+sizeof(currSize)],scratch,FRAME_DATA_MAX,&filteredLen) != Z_OK)
+	{
+		return;//Its pixels are left as not received
+	}
+	unsigned char* above = &scratch[FRAME_DATA_MAX];
+	
+	uint64_t pos = currSize;
+	uint32_t filteredPos = 0;
+	while(filteredLen-filteredPos > 1 && pos < passEnd)
+	{
+		unsigned char type = scratch[filteredPos++];
+		uint32_t length = stride - (pos-passes->start[p])%stride;
+		length = (length < filteredLen-filteredPos ? length : filteredLen-filteredPos);
+		length = (length < passEnd-pos ? length : passEnd-pos);
+		
+		rowAbove(image,stride,currSize,pos,length,above);
+		if(lodepng_unfilter_scanline(&image[pos],&scratch[filteredPos],above,bytesPerPixel,type,length) != 0)
+		{
+			printf("Error! Unknown PNG filter type %u\n",type);
+			return;
+		}
+		filteredPos += length;
+		pos += length;
+	}
+	
+	if(received != NULL)
+	{
+		for(uint64_t x = currSize/bytesPerPixel;x<pos/bytesPerPixel;x++)
+		{
+			received[x] = 1;
+		}
+	}
+}
+
+/**
+ *  fillProgressive  - Fills in missing pixels of an Adam7 image
+ *
+ *  Gives every pixel that was not received the value of the pixel above and to the left of it in the passes before its own,
+ *	so an image cut short after the first passes is a full size image at a lower resolution rather than a sparse one.
+ *	
+ *	Arguments :
+ *	@image : Deinterlaced raw pixel buffer.
+ *	@received : Deinterlaced received flag of each pixel, from decodePngFrame.
+ *	@width : Image width in pixels.
+ *	@height : Image height in pixels.
+ *	@bytesPerPixel : Bytes in each pixel of the image.
+ */
+void fillProgressive(unsigned char* image, uint8_t* received, unsigned width, unsigned height, uint8_t bytesPerPixel)
+{
+	//Start, spacing and the spacing of all pixels up to and including each Adam7 pass
+	static const unsigned passX[7] = {0,4,0,2,0,1,0}, passY[7] = {0,0,4,0,2,0,1};
+	static const unsigned passDX[7] = {8,8,4,4,2,2,1}, passDY[7] = {8,8,8,4,4,2,2};
+	static const unsigned gridX[7] = {8,4,4,2,2,1,1}, gridY[7] = {8,8,4,4,2,2,1};
+	
+	for(int p = 1;p<7;p++)//Pixels of the first pass have nothing coarser to copy and are left as 0x00
+	{
+		for(unsigned y = passY[p];y<height;y += passDY[p])
+		{
+			for(unsigned x = passX[p];x<width;x += passDX[p])
+			{
+				size_t pixel = (size_t)y*width+x;
+				if(!received[pixel])
+				{
+					size_t parent = (size_t)(y - y%gridY[p-1])*width + x - x%gridX[p-1];
+					memcpy(&image[pixel*bytesPerPixel],&image[parent*bytesPerPixel],bytesPerPixel);
+				}
+			}
+		}
+	}
+}
+
+/**
+ *  pngWorker  - PNG worker thread
+ *
+ *  Takes frames queued by queuePngFrame and decompresses them into the shared image until stopPngWorkers is called.
+ */
+void* pngWorker(void* arg)
+{
+	struct tempCompData frame;
+	unsigned char* scratch = malloc(FRAME_DATA_MAX + pngAsm.stride);
+	if(scratch == NULL)
+	{
+		printf("Error! Could not allocate decompression buffer\n");
+		exit(-1);
+	}
+	
+	while(1)
+	{
+		pthread_mutex_lock(&pngAsm.lock);
+		while(pngAsm.jobHead == pngAsm.jobTail && !pngAsm.done)
+		{
+			pthread_cond_wait(&pngAsm.ready,&pngAsm.lock);
+		}
+		if(pngAsm.jobHead == pngAsm.jobTail)
+		{
+			pthread_mutex_unlock(&pngAsm.lock);
+			releaseCodecs();
+			free(scratch);
+			return NULL;
+		}
+		memcpy(&frame,&pngAsm.jobs[pngAsm.jobTail % PNG_JOB_SLOTS],sizeof(frame));
+		pngAsm.jobTail++;
+		pthread_mutex_unlock(&pngAsm.lock);
+		
+		decodePngFrame(&frame,pngAsm.imageId,&pngAsm.passes,pngAsm.image,pngAsm.bytesPerPixel,pngAsm.received,scratch);
+		
+		pthread_mutex_lock(&pngAsm.lock);
+		if(frame.sequence >= pngAsm.decodedSlots)
+		{
+			growSequenceTable((void**)&pngAsm.decoded,&pngAsm.decodedSlots,1,frame.sequence);
+		}
+		pngAsm.decoded[frame.sequence] = 1;
+		pthread_mutex_unlock(&pngAsm.lock);
+	}
+}
+
+/**
+ *  addPngMetadata  - Collects a PNG metadata fragment
+ *
+ *  Copies the fragment carried by a PNG metadata frame into pngAsm.meta. The image ID of the first metadata frame received is
+ *	taken as the image being transferred and fragments of any other image are ignored. Other frames are ignored too.
+ *	
+ *	Arguments :
+ *	@frame : PNG frame to take the fragment from.
+ *
+ *	Returns 1 if the frame completed the metadata, otherwise 0.
+ */
+int addPngMetadata(struct tempCompData* frame)
+{
+	uint16_t imageId;
+	uint64_t currSize;
+	uint32_t metaSize, metaOffset;
+	if(frame->len < PNG_META_HEADER_SIZE || memcmp(frame->data,"PNG",3) != 0)
+	{
+		return 0;
+	}
+	memcpy(&imageId,&frame->data[FRAME_HEADER_SIZE],sizeof(imageId));
+	memcpy(&currSize,&frame->data[PNG_HEADER_SIZE],sizeof(currSize));
+	memcpy(&metaSize,&frame->data[PNG_HEADER_SIZE+sizeof(currSize)],sizeof(metaSize));
+	memcpy(&metaOffset,&frame->data[PNG_HEADER_SIZE+sizeof(currSize)+sizeof(metaSize)],sizeof(metaOffset));
+	uint32_t fragSize = frame->len - PNG_META_HEADER_SIZE;
+	if(currSize != PNG_META_OFFSET || metaSize == 0)
+	{
+		return 0;
+	}
+	
+	if(pngAsm.meta == NULL)
+	{
+		pngAsm.meta = calloc(metaSize+4,1);//Zero padding lets readPngMetadata look for a chunk name at the very end
+		pngAsm.metaHave = calloc(metaSize,1);
+		if(pngAsm.meta == NULL || pngAsm.metaHave == NULL)
+		{
+			printf("Error! Could not allocate PNG metadata\n");
+			exit(-1);
+		}
+		pngAsm.imageId = imageId;
+		pngAsm.metaSize = metaSize;
+		pngAsm.metaMissing = metaSize;
+	}
+	if(imageId != pngAsm.imageId || metaSize != pngAsm.metaSize || pngAsm.metaMissing == 0 || metaOffset >= metaSize || fragSize > metaSize-metaOffset)
+	{
+		return 0;
+	}
+	
+	memcpy(&pngAsm.meta[metaOffset],&frame->data[PNG_META_HEADER_SIZE],fragSize);
+	for(uint32_t x = metaOffset;x<metaOffset+fragSize;x++)
+	{
+		pngAsm.metaMissing -= !pngAsm.metaHave[x];
+		pngAsm.metaHave[x] = 1;
+	}
+	return pngAsm.metaMissing == 0;
+}
+
+/**
+ *  startPngWorkers  - Starts incremental PNG reconstruction
+ *
+ *  Allocates the image described by the completed PNG metadata and starts PNG_WORKERS worker threads.
+ */
+void startPngWorkers()
+{
+	LodePNGState state;
+	uint8_t bytesPerPixel, interlace;
+	unsigned width, height;
+	
+	lodepng_state_init(&state);
+	int metaRead = readPngMetadata(pngAsm.meta,pngAsm.metaSize,&state,&bytesPerPixel,&width,&height,&interlace);
+	lodepng_state_cleanup(&state);
+	
+	pngAsm.started = -1;
+	if(!metaRead)
+	{
+		return;
+	}
+	
+	pngAsm.imageSize = bytesPerPixel*width*height;
+	pngAsm.stride = bytesPerPixel*width;
+	pngAsm.bytesPerPixel = bytesPerPixel;
+	imagePasses(&pngAsm.passes,width,height,bytesPerPixel,interlace);
+	pngAsm.image = calloc(pngAsm.imageSize,1);
+	pngAsm.received = (interlace ? calloc((size_t)width*height,1) : NULL);
+	pngAsm.jobs = malloc(PNG_JOB_SLOTS*sizeof(struct tempCompData));
+	if(pngAsm.image == NULL || pngAsm.jobs == NULL || (interlace && pngAsm.received == NULL))
+	{
+		free(pngAsm.image);
+		free(pngAsm.received);
+		free(pngAsm.jobs);
+		pngAsm.image = NULL;
+		pngAsm.received = NULL;
+		return;
+	}
+	
+	pthread_mutex_init(&pngAsm.lock,NULL);
+	pthread_cond_init(&pngAsm.ready,NULL);
+	for(int x = 0;x<PNG_WORKERS;x++)
+	{
+		pthread_create(&pngAsm.workers[x],NULL,pngWorker,NULL);
+	}
+	pngAsm.started = 1;
+}
+
+/**
+ *  queuePngFrame  - Hands a frame to the PNG workers
+ *
+ *  Copies PNG frames into the worker queue, starting the workers once the metadata frames have been received. Frames that
+ *	arrive before that or while the queue is full are skipped and decompressed after the transfer instead.
+ *	
+ *	Arguments :
+ *	@frame : Frame taken from the receive ring.
+ */
+void queuePngFrame(struct tempCompData* frame)
+{
+	if(PNG_WORKERS == 0 || pngAsm.started == -1 || frame->len < PNG_HEADER_SIZE || memcmp(frame->data,"PNG",3) != 0)
+	{
+		return;
+	}
+	if(pngAsm.started == 0)
+	{
+		if(addPngMetadata(frame))
+		{
+			startPngWorkers();
+		}
+		return;
+	}
+	
+	pthread_mutex_lock(&pngAsm.lock);
+	if(pngAsm.jobHead - pngAsm.jobTail < PNG_JOB_SLOTS)
+	{
+		memcpy(&pngAsm.jobs[pngAsm.jobHead % PNG_JOB_SLOTS],frame,sizeof(struct tempCompData));
+		pngAsm.jobHead++;
+		pthread_cond_signal(&pngAsm.ready);
+	}
+	pthread_mutex_unlock(&pngAsm.lock);
+}
+
+/**
+ *  stopPngWorkers  - Ends incremental PNG reconstruction
+ *
+ *  Waits for the worker threads to finish every queued frame. Must only be called after the writer thread has exited.
+ */
+void stopPngWorkers()
+{
+	if(pngAsm.started != 1)
+	{
+		return;
+	}
+	
+	pthread_mutex_lock(&pngAsm.lock);
+	pngAsm.done = 1;
+	pthread_cond_broadcast(&pngAsm.ready);
+	pthread_mutex_unlock(&pngAsm.lock);
+	
+	for(int x = 0;x<PNG_WORKERS;x++)
+	{
+		pthread_join(pngAsm.workers[x],NULL);
+	}
+	pthread_mutex_destroy(&pngAsm.lock);
+	pthread_cond_destroy(&pngAsm.ready);
+	free(pngAsm.jobs);
+}
+
+/**
+ *  monotonicMs  - Monotonic clock
+ *
+ *  Returns the current CLOCK_MONOTONIC time in milliseconds. Unlike clock() this keeps counting while the process is idle.
+ */
+long long monotonicMs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return (long long)now.tv_sec*1000 + now.tv_nsec/1000000;
+}
+
+/**
+ *  writeFrames  - Vectored frame write
+ *
+ *  Writes every buffer described by iov to fd, retrying on partial writes and interrupts.
+ *	
+ *	Arguments :
+ *	@fd : File descriptor to write to.
+ *	@iov : Array of buffers to write in order. Entries are modified as they are consumed.
+ *	@count : Number of entries in iov.
+ */
+void writeFrames(int fd, struct iovec* iov, int count)
+{
+	while(count > 0)
+	{
+		ssize_t written = writev(fd, iov, count);
+		if(written < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			printf("Error! Could not write to temporary file\n");
+			exit(-1);
+		}
+		
+		while(count > 0 && written >= (ssize_t)iov->iov_len)
+		{
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if(count > 0)
+		{
+			iov->iov_base = (char*)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+}
+
+/**
+ *  countFountainSymbol  - Tracks a fountain coded transfer as it arrives
+ *
+ *  Counts a fountain frame towards its block in fountain, once per sequence as only the first copy is stored.
+ *	
+ *	Arguments :
+ *	@frame : Frame taken from the receive ring, before it is stored.
+ *
+ *	Returns 1 once every block of the transfer holds FOUNTAIN_MARGIN symbols more than it has data frames, otherwise 0.
+ */
+int countFountainSymbol(struct tempCompData* frame)
+{
+	uint32_t firstSeq, frameCount, block;
+	if(frame->len <= FOUNTAIN_HEADER_SIZE+FEC_SYMBOL_EXTRA || memcmp(frame->data,"LTC",3) != 0 || (frame->sequence < store.slots && store.record[frame->sequence] != 0))
+	{
+		return 0;
+	}
+	memcpy(&firstSeq,&frame->data[FRAME_HEADER_SIZE+3],sizeof(firstSeq));
+	memcpy(&frameCount,&frame->data[FRAME_HEADER_SIZE+3+sizeof(firstSeq)],sizeof(frameCount));
+	memcpy(&block,&frame->data[FRAME_HEADER_SIZE+3+2*sizeof(uint32_t)],sizeof(block));
+	uint32_t blockCount = ((uint64_t)frameCount+FOUNTAIN_BLOCK-1)/FOUNTAIN_BLOCK;
+	if(fountain.frameCount == 0 && frameCount != 0)
+	{
+		fountain.symbols = calloc(blockCount,sizeof(uint32_t));
+		if(fountain.symbols == NULL)
+		{
+			printf("Error! Could not allocate fountain progress\n");
+			exit(-1);
+		}
+		fountain.firstSeq = firstSeq;
+		fountain.frameCount = frameCount;
+	}
+	if(firstSeq != fountain.firstSeq || frameCount != fountain.frameCount || block >= blockCount)
+	{
+		return 0;
+	}
+	
+	uint32_t blockFrames = (frameCount-block*FOUNTAIN_BLOCK < FOUNTAIN_BLOCK ? frameCount-block*FOUNTAIN_BLOCK : FOUNTAIN_BLOCK);
+	if(++fountain.symbols[block] == blockFrames+FOUNTAIN_MARGIN(blockFrames))
+	{
+		fountain.blocksReady++;
+	}
+	return (fountain.blocksReady == blockCount);
+}
+
+/**
+ *  processQueue  - Writer thread
+ *
+ *  Sleeps on wakeFd until recv_frame publishes frames, then drains everything in the receive ring into the frame store.
+ *	Frames past the memory budget are written to the spill file with one writev per WRITE_BATCH frames. Returns RECV_TIMEOUT seconds after the last frame once the ring is empty,
+ *	or as soon as every block of a fountain coded transfer has enough symbols to be decoded.
+ */
+void* processQueue(void* arg)
+{
+  struct iovec batch[WRITE_BATCH];
+  
+  while(1)
+  {
+    unsigned int tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring.head, memory_order_acquire);
+
+    if(tail == head)
+    {
+      atomic_store(&ring.sleeping, 1);
+      if(tail == atomic_load(&ring.head))//Checks again after announcing the sleep so a frame published in between is not missed
+      {
+        int timeout = -1;//Waits indefinitely for the first frame
+        long long lastTime = atomic_load(&lastframeTime);
+        if(lastTime != 0)
+        {
+          long long remaining = lastTime + RECV_TIMEOUT*1000 - monotonicMs();
+          if(remaining <= 0)
+          {
+            return NULL;
+          }
+          timeout = remaining;
+        }
+        
+        struct pollfd wake = {wakeFd, POLLIN, 0};
+        if(poll(&wake, 1, timeout) > 0)
+        {
+          uint64_t count;
+          read(wakeFd, &count, sizeof(count));
+        }
+      }
+      atomic_store(&ring.sleeping, 0);
+      continue;
+    }
+
+    while(tail != head)
+    {
+      int count = 0;
+      while(tail != head && count < WRITE_BATCH)
+      {
+        struct tempCompData* frame = &ring.slots[tail & (RING_SLOTS-1)].frame;
+        if(countFountainSymbol(frame))
+        {
+          atomic_store(&transferDone, 1);
+        }
+        size_t spillSize = storeFrame(frame);
+        if(spillSize != 0)
+        {
+          batch[count].iov_base = frame;
+          batch[count].iov_len = spillSize;
+          count++;
+        }
+        queuePngFrame(frame);
+        tail++;
+      }
+      if(count > 0)
+      {
+        writeFrames(store.spillFd, batch, count);
+      }
+      atomic_store_explicit(&ring.tail, tail, memory_order_release);//Hands the slots back to recv_frame
+      if(atomic_load(&transferDone))
+      {
+        return NULL;
+      }
+    }
+  }
+}
+
+/**
+ *  sequenceInWindow  - Frame sequence check
+ *
+ *  Checks a frame's sequence is at most SEQUENCE_WINDOW past the highest sequence received, so one corrupt or foreign frame
+ *	cannot make the sequence tables grow towards 4G entries. A fountain symbol follows the data frame sequences its header
+ *	reserves, which are never sent, so it may be that far past the end of them instead as long as they start inside the window.
+ *	
+ *	Arguments :
+ *	@sequence : Sequence of the frame.
+ *	@buff : Frame data.
+ *	@len : Length of the frame data.
+ *
+ *	Returns 1 if the frame can be stored, otherwise 0.
+ */
+int sequenceInWindow(uint32_t sequence, char* buff, uint16_t len)
+{
+	uint64_t limit = (uint64_t)highestSeq+SEQUENCE_WINDOW;
+	if(len > FOUNTAIN_HEADER_SIZE && memcmp(buff,"LTC",3) == 0)
+	{
+		uint32_t firstSeq, frameCount;
+		memcpy(&firstSeq,&buff[FRAME_HEADER_SIZE+3],sizeof(firstSeq));
+		memcpy(&frameCount,&buff[FRAME_HEADER_SIZE+3+sizeof(firstSeq)],sizeof(frameCount));
+		uint64_t reservedEnd = (uint64_t)firstSeq+frameCount;
+		if(firstSeq <= limit && reservedEnd <= sequence && reservedEnd+SEQUENCE_WINDOW > limit)
+		{
+			limit = reservedEnd+SEQUENCE_WINDOW;
+		}
+	}
+	return (sequence < NO_FRAME && sequence <= limit);
+}
+
+void vmac_register(void* ptr);
+void del_name(char* interest_name, uint16_t name_len);
+void send_vmac(uint16_t type, uint16_t rate, uint16_t seq, char *buff, uint16_t len, char * interest_name, uint16_t name_len);
+
+/**
+ *  recv_frame  - Receives and stores data frames
+ *
+ *  Copies data length, frame sequence, and data buffer into the next free slot of the receive ring for the writer thread.
+ *	Frames are dropped and counted if the ring is full, they are longer than a ring slot or their sequence is outside the window. Also does comparisons to find the range of sequences and records the time of the frame.
+ *
+ *	No processing of the received data is done other than handing it to the writer thread, and no locks or allocations are taken.
+ */
+void recv_frame(uint8_t type, uint64_t enc, char * buff, uint16_t len, uint16_t seq,char* interest_name, uint16_t interest_name_len)
+{	
+	if(type==1 && !atomic_load(&transferDone) /*&& isDone == 0*/)
+	{
+		//printf("seq: %u\n",seq);
+		/*
+		char buffer[len+1];
+		memcpy(buffer,buff,len);
+		
+		buffer[len]='\0';//Adding null terminator for string comparison
+		if(strcmp("DONE",buffer)==0)//String comparison to determine last frame
+		{
+			//printf("DONE Received");
+			highestSeq = seq-1;
+			isDone=1;
+			return;
+		}
+		*/
+		
+		atomic_store(&lastframeTime, monotonicMs());//Records frame time for the receiver timeout
+		
+		if(len < FRAME_HEADER_SIZE)
+		{
+			return;
+		}
+		if(len > BUFFER_SIZE)//Would overrun its slot into the next frame in the ring
+		{
+			ring.rejected++;
+			return;
+		}
+		uint32_t sequence;//Sender's frame sequence, used in place of the 16-bit V-MAC seq so transfers are not limited by its wrap-around
+		memcpy(&sequence,&buff[3],sizeof(sequence));
+		if(!sequenceInWindow(sequence,buff,len))
+		{
+			ring.rejected++;
+			return;
+		}
 		
-		buffer[len]='\0';//Adding null terminator for string comparison
-		if(strcmp("DONE",buffer)==0)//String comparison to determine last frame
+		unsigned int head = atomic_load_explicit(&ring.head, memory_order_relaxed);
+		unsigned int tail = atomic_load_explicit(&ring.tail, memory_order_acquire);
+		if(head - tail >= RING_SLOTS)//Writer thread has fallen a full ring behind
 		{
-			//printf("DONE Received");
-			highestSeq = seq-1;
-			isDone=1;
+			ring.dropped++;
 			return;
 		}
-		*/
 		
-		writeCompStruct(&toWrite,len,seq,buff);
-		//fwrite(&toWrite,sizeof(struct tempCompData),1,compTemp);
-
-		pthread_mutex_lock(&lock); 
-		enQueue(queue, &toWrite);
-		pthread_mutex_unlock(&lock);
-
-		hasStarted = 1;
+		writeCompStruct(&ring.slots[head & (RING_SLOTS-1)].frame,len,sequence,buff);
+		atomic_store(&ring.head, head+1);//Publishes the frame to the writer thread
+		
+		if(head + 1 - tail > ring.highWater)
+		{
+			ring.highWater = head + 1 - tail;
+		}
+		
+		if(atomic_load(&ring.sleeping))
+		{
+			uint64_t wake = 1;
+			write(wakeFd, &wake, sizeof(wake));
+		}
 		
 		if(firstSeqReceived==0)
 		{
-			lowestSeq = seq;
+			lowestSeq = sequence;
 			firstSeqReceived = 1;
 		}
-		if(seq>highestSeq)
+		if(sequence>highestSeq)
 		{
-			highestSeq = seq;
+			highestSeq = sequence;
 		}
-		if(seq<lowestSeq)
+		if(sequence<lowestSeq)
 		{
-			lowestSeq = seq;
+			lowestSeq = sequence;
 		}
 		
-		lastframeTime = clock()/CLOCKS_PER_SEC;//Records frame time for the receiver timeout
-		
 		//fprintf(timestamps,"Received Frame @ timestamp=%lu %"PRIdMAX".%03ld - Count: %u\n",(unsigned long)time(NULL),(intmax_t)sec, ms, frameCounter);
 		frameCounter++;
 		receivedSize += len;
@@ -310,28 +1918,19 @@ int main()
 	uint16_t len = strlen(data)+1;
 	uint16_t name_len = strlen(intname);
 	
-	//Queue Initialization
-	queue = createQueue();
-
+	initStore();
+	
 	//Thread stuff
-	if (pthread_mutex_init(&lock, NULL) != 0) 
-	{ 
-		printf("\n mutex init has failed\n"); 
-		return 1; 
-	} 
-
-	int threadError = pthread_create(&tid, NULL, processQueue, queue);
+	wakeFd = eventfd(0, EFD_NONBLOCK);
+	if (wakeFd < 0)
+	{
+		printf("Error! Could not create writer thread event\n");
+		exit(-1);
+	}
+	
+	int threadError = pthread_create(&tid, NULL, processQueue, NULL);
 	if (threadError != 0) 
 		printf("\nThread can't be created :[%s]", strerror(threadError));
-
-	//Creating temp files to write struct with data frame and associated sequence number
-	compTemp = fopen("compTemp", "wb+");//Received compressed data
-	
-	if (compTemp == NULL) 
-    {   
-		printf("Error! Could not open temporary file\n"); 
-		exit(-1);
-    }
 	
 	timestamps = fopen("timestamps", "w");//Received compressed data
 	
@@ -357,7 +1956,8 @@ int main()
 	
 	//Waits for other thread to finish writing data to file
 	pthread_join(tid, NULL);
-	pthread_mutex_destroy(&lock);
+	close(wakeFd);
+	stopPngWorkers();
 	
 	fprintf(timestamps,"Data Received @ timestamp=%lu %"PRIdMAX".%03ld\n",(unsigned long)time(NULL),(intmax_t)sec, ms);
 
@@ -365,17 +1965,20 @@ int main()
 	//isDone = 1;
 	printf("Data Received\n");
 	printf("%u Frames Received\n",frameCounter);
+	printf("Receive ring high-water mark: %u/%u frames, %u frames dropped, %u frames rejected\n",ring.highWater,RING_SLOTS,ring.dropped,ring.rejected);
 	
 	//printf("Lowest seq; %u",lowestSeq);
 	
+	openStore();
+	recoverFrames();
+	recoverFountain();
+	buildFrameIndex();
+	
 	char fileType[4];
-	fseek(compTemp,0,SEEK_SET);
-	while(fread(&toWrite, sizeof(struct tempCompData), 1, compTemp))//Writes frame with lowest sequence to toWrite
+	struct tempCompData* frame = storedFrame(frames.receivedCount > 0 ? frames.received[0] : lowestSeq);
+	if(frame != NULL)//Writes frame with lowest sequence to toWrite
 	{
-		if(toWrite.sequence == lowestSeq)
-		{
-			break;
-		}
+		memcpy(&toWrite,frame,sizeof(toWrite));
 	}
 	memcpy(&fileType,&toWrite.data,3);
 	fileType[3] = '\0';
@@ -385,8 +1988,7 @@ int main()
 	//NOT RELATED TO VIDEO TRANSMISSION
 	if(strcmp(fileType,"PNG")==0)
 	{
-		uint16_t headerSize = 0;
-		uint8_t bytesPerPixel, colortype;
+		uint8_t bytesPerPixel, interlace;
 		unsigned width, height;
 		
 		unsigned error;
@@ -396,321 +1998,87 @@ int main()
 	
 		lodepng_state_init(&state);
 		
-		headerSize += 3;//Increase header size to include the "PNG" string
-		
-		memcpy(&bytesPerPixel,&toWrite.data[headerSize],sizeof(bytesPerPixel));
-		//printf("BytesPerPixel: %u\n",bytesPerPixel);
-		headerSize += sizeof(bytesPerPixel);
-		
-		memcpy(&colortype,&toWrite.data[headerSize],sizeof(colortype));
-		//printf("Colortype: %u\n",colortype);
-		headerSize += sizeof(colortype);
-		if(colortype==0)
-		{
-			state.info_raw.colortype = LCT_GREY;
-		}
-		else if(colortype==2)
+		for(uint32_t x = 0;x<frames.receivedCount && (pngAsm.meta == NULL || pngAsm.metaMissing != 0);x++)//Finishes the metadata if the worker threads never started
 		{
-			state.info_raw.colortype = LCT_RGB;
+			addPngMetadata(storedFrame(frames.received[x]));
 		}
-		else if(colortype==3)
-		{
-			state.info_raw.colortype = LCT_PALETTE;
-		}
-		else if(colortype==4)
-		{
-			state.info_raw.colortype = LCT_GREY_ALPHA;
-		}
-		else
-		{
-			state.info_raw.colortype = LCT_RGBA;
-		}
-		
-		state.info_raw.bitdepth = (bytesPerPixel/(colortype==0?1:(colortype==2?3:(colortype==4?2:4))))*8;
-		
-		memcpy(&width,&toWrite.data[headerSize],sizeof(width));
-		//printf("Width: %u\n",width);
-		headerSize += sizeof(width);
-		
-		memcpy(&height,&toWrite.data[headerSize],sizeof(height));
-		//printf("Height: %u\n",height);
-		headerSize += sizeof(height);
-		
-		unsigned char* image = malloc(bytesPerPixel*width*height);
-		
-		char chunkName[5];
-		memcpy(&chunkName,&toWrite.data[headerSize],4);
-		chunkName[4] = '\0';
-		//printf("First chunk: %s\n",chunkName);
-		
-		const unsigned isPresent = 1;
-		if(strcmp("bKGD",chunkName)==0)
+		if(pngAsm.meta == NULL || pngAsm.metaMissing != 0 || !readPngMetadata(pngAsm.meta,pngAsm.metaSize,&state,&bytesPerPixel,&width,&height,&interlace))//Exits and cleans up if every copy of part of the metadata was lost
 		{
-			//printf("bkGD Found\n");
+			printf("Error: PNG metadata lost in transmission\n");
 			
-			memcpy(&state.info_png.background_defined,&isPresent,sizeof(state.info_png.background_defined));
+			closeStore();
 			
-			headerSize += 4;
-			memcpy(&state.info_png.background_r,&toWrite.data[headerSize],sizeof(state.info_png.background_r));
-			headerSize += sizeof(state.info_png.background_r);
-			memcpy(&state.info_png.background_g,&toWrite.data[headerSize],sizeof(state.info_png.background_g));
-			headerSize += sizeof(state.info_png.background_g);
-			memcpy(&state.info_png.background_b,&toWrite.data[headerSize],sizeof(state.info_png.background_b));
-			headerSize += sizeof(state.info_png.background_b);
+			del_name(intname,name_len);
 			
-			memcpy(&chunkName,&toWrite.data[headerSize],4);
-			chunkName[4] = '\0';
+			exit(-1);
 		}
-		if(strcmp("pHYs",chunkName)==0)
+		uint32_t imageSize = bytesPerPixel*width*height;
+		struct imagePasses passes;
+		imagePasses(&passes,width,height,bytesPerPixel,interlace);
+		
+		unsigned char* image;
+		uint8_t* received = NULL;
+		if(pngAsm.image != NULL && pngAsm.imageSize == imageSize)//Most frames have already been decompressed by the worker threads
 		{
-			//printf("pHYs Found\n");
-			
-			memcpy(&state.info_png.phys_defined,&isPresent,sizeof(state.info_png.phys_defined));
-			
-			headerSize += 4;
-			memcpy(&state.info_png.phys_x,&toWrite.data[headerSize],sizeof(state.info_png.phys_x));
-			headerSize += sizeof(state.info_png.phys_x);
-			
-			memcpy(&state.info_png.phys_y,&toWrite.data[headerSize],sizeof(state.info_png.phys_y));
-			headerSize += sizeof(state.info_png.phys_y);
-			
-			memcpy(&state.info_png.phys_unit,&toWrite.data[headerSize],sizeof(state.info_png.phys_unit));
-			headerSize += sizeof(state.info_png.phys_unit);
-			
-			memcpy(&chunkName,&toWrite.data[headerSize],4);
-			chunkName[4] = '\0';
+			image = pngAsm.image;
+			received = pngAsm.received;
 		}
-		if(strcmp("iCCP",chunkName)==0)
+		else
 		{
-			//printf("iCCP Found\n");
-			
-			memcpy(&state.info_png.iccp_defined,&isPresent,sizeof(state.info_png.iccp_defined));
-			
-			headerSize += 4;
-			
-			uint8_t profNameLen;
-			unsigned iccSize;
-			memcpy(&profNameLen,&toWrite.data[headerSize],sizeof(profNameLen));
-			headerSize += sizeof(profNameLen);
-			char* profName = malloc(profNameLen);
-			
-			memcpy(profName,&toWrite.data[headerSize],profNameLen);
-			headerSize += profNameLen;
-
-			memcpy(&iccSize,&toWrite.data[headerSize],sizeof(iccSize));
-			headerSize += sizeof(iccSize);
-			unsigned char *iccProf = malloc(iccSize);
-			
-			memcpy(iccProf,&toWrite.data[headerSize],iccSize);
-			headerSize += state.info_png.iccp_profile_size;
-			
-			lodepng_set_icc(&state.info_png,profName,iccProf,iccSize);
-			free(profName);
-			free(iccProf);
-			
-			memcpy(&chunkName,&toWrite.data[headerSize],4);
-			chunkName[4] = '\0';
+			free(pngAsm.image);//Worker threads' image does not match the metadata, so it is started again
+			free(pngAsm.received);
+			free(pngAsm.decoded);//and every frame is decompressed into the new one
+			pngAsm.decoded = NULL;
+			pngAsm.decodedSlots = 0;
+			image = calloc(imageSize,1);//Pixels of missing frames are left as 0x00
+			if(interlace)
+			{
+				received = calloc((size_t)width*height,1);
+			}
 		}
-		if(strcmp("sRGB",chunkName)==0)
+		if(image == NULL || (interlace && received == NULL))
 		{
-			//printf("sRGB Found\n");
-			
-			//Set cHRM & gAMA to sRGB values in case decoder does not use sRGB
-			memcpy(&state.info_png.gama_defined,&isPresent,sizeof(state.info_png.gama_defined));
-			state.info_png.gama_gamma = 45455;
-			memcpy(&state.info_png.chrm_defined,&isPresent,sizeof(state.info_png.chrm_defined));
-			state.info_png.chrm_white_x = 31270;
-			state.info_png.chrm_white_y = 32900;
-			state.info_png.chrm_red_x = 64000;
-			state.info_png.chrm_red_y = 33000;
-			state.info_png.chrm_green_x = 30000;
-			state.info_png.chrm_green_y = 60000;
-			state.info_png.chrm_blue_x = 15000;
-			state.info_png.chrm_blue_y = 6000;
-			
-			memcpy(&state.info_png.srgb_defined,&isPresent,sizeof(state.info_png.srgb_defined));
-			
-			headerSize += 4;
-			memcpy(&state.info_png.srgb_intent,&toWrite.data[headerSize],sizeof(state.info_png.srgb_intent));
-			headerSize += sizeof(state.info_png.srgb_intent);
-			
-			memcpy(&chunkName,&toWrite.data[headerSize],4);
-			chunkName[4] = '\0';
+			printf("Error! Could not allocate image\n");
+			exit(-1);
 		}
-		if(strcmp("cHRM",chunkName)==0)
+		
+		unsigned char* scratch = malloc(FRAME_DATA_MAX + bytesPerPixel*width);
+		if(scratch == NULL)
 		{
-			//printf("cHRM Found\n");
-			
-			memcpy(&state.info_png.chrm_defined,&isPresent,sizeof(state.info_png.chrm_defined));
-			
-			headerSize += 4;
-			memcpy(&state.info_png.chrm_white_x,&toWrite.data[headerSize],sizeof(state.info_png.chrm_white_x));
-			headerSize += sizeof(state.info_png.chrm_white_x);
-			
-			memcpy(&state.info_png.chrm_white_y,&toWrite.data[headerSize],sizeof(state.info_png.chrm_white_y));
-			headerSize += sizeof(state.info_png.chrm_white_y);
-			
-			memcpy(&state.info_png.chrm_red_x,&toWrite.data[headerSize],sizeof(state.info_png.chrm_red_x));
-			headerSize += sizeof(state.info_png.chrm_red_x);
-			
-			memcpy(&state.info_png.chrm_red_y,&toWrite.data[headerSize],sizeof(state.info_png.chrm_red_y));
-			headerSize += sizeof(state.info_png.chrm_red_y);
-			
-			memcpy(&state.info_png.chrm_green_x,&toWrite.data[headerSize],sizeof(state.info_png.chrm_green_x));
-			headerSize += sizeof(state.info_png.chrm_green_x);
-			
-			memcpy(&state.info_png.chrm_green_y,&toWrite.data[headerSize],sizeof(state.info_png.chrm_green_y));
-			headerSize += sizeof(state.info_png.chrm_green_y);
-			
-			memcpy(&state.info_png.chrm_blue_x,&toWrite.data[headerSize],sizeof(state.info_png.chrm_blue_x));
-			headerSize += sizeof(state.info_png.chrm_blue_x);
-			
-			memcpy(&state.info_png.chrm_blue_y,&toWrite.data[headerSize],sizeof(state.info_png.chrm_blue_y));
-			headerSize += sizeof(state.info_png.chrm_blue_y);
-			
-			memcpy(&chunkName,&toWrite.data[headerSize],4);
-			chunkName[4] = '\0';
+			printf("Error! Could not allocate decompression buffer\n");
+			exit(-1);
 		}
-		if(strcmp("gAMA",chunkName)==0)
+		for(uint32_t x = 0;x<frames.receivedCount;x++)//Decompresses every frame the worker threads did not
 		{
-			//printf("gAMA Found\n");
-			
-			memcpy(&state.info_png.gama_defined,&isPresent,sizeof(state.info_png.gama_defined));
-			
-			headerSize += 4;
-			memcpy(&state.info_png.gama_gamma,&toWrite.data[headerSize],sizeof(state.info_png.gama_gamma));
-			headerSize += sizeof(state.info_png.gama_gamma);
-			
-			memcpy(&chunkName,&toWrite.data[headerSize],4);
-			chunkName[4] = '\0';
+			uint32_t seq = frames.received[x];
+			if(seq >= pngAsm.decodedSlots || !pngAsm.decoded[seq])
+			{
+				decodePngFrame(storedFrame(seq),pngAsm.imageId,&passes,image,bytesPerPixel,received,scratch);
+			}
 		}
+		free(scratch);
+		free(pngAsm.decoded);		
+		free(pngAsm.meta);
+		free(pngAsm.metaHave);
 		
-		if(strcmp("IDAT",chunkName)==0)
+		if(interlace)//Puts the passes back in row order and fills in what was not received from the coarser passes
 		{
-			//printf("IDAT Found\n");
-			headerSize += 4;		
-			
-			struct sizeData* currSizeArr = malloc(sizeof(struct sizeData));
-			fseek(compTemp,0,SEEK_SET);
-			
-			int count = 1;
-			while(fread(&toWrite, sizeof(struct tempCompData), 1, compTemp))
+			unsigned char* rows = malloc(imageSize);
+			uint8_t* rowsReceived = malloc((size_t)width*height);
+			if(rows == NULL || rowsReceived == NULL)
 			{
-				currSizeArr = realloc(currSizeArr,count*sizeof(struct sizeData));
-				memcpy(&currSizeArr[count-1].sequence,&toWrite.sequence,sizeof(toWrite.sequence));
-				memcpy(&currSizeArr[count-1].size,&toWrite.data[headerSize],sizeof(uint32_t));
-				//printf("Size: %llu\n",currSizeArr[count-1].size);
-				count++;
+				printf("Error! Could not allocate image\n");
+				exit(-1);
 			}
-			count -= 2;
-			//printf("currSizeArr allocated and filled\n");
+			lodepng_adam7_deinterlace(rows,image,width,height,bytesPerPixel*8);
+			lodepng_adam7_deinterlace(rowsReceived,received,width,height,8);
+			fillProgressive(rows,rowsReceived,width,height,bytesPerPixel);
 			
-			uint32_t currSize = 0;
-			uint16_t offsetOut = 0;
-			uint32_t nextSeq = 0;
-			uint8_t wasFound = 0;//=0 when the expected sequence wasn't found
-			uLongf destLen, temp, compLen;
-			while(nextSeq<=highestSeq)
-			{
-				//printf("Current Seq %d\n",nextSeq);
-				fseek(compTemp,0,SEEK_SET);
-				while(fread(&toWrite, sizeof(struct tempCompData), 1, compTemp))//Scans temp file for data associated with nextSeq
-				{
-					//printf("Sequence Read: %d\n",toWrite.sequence);
-					if(toWrite.sequence == nextSeq)
-					{
-						memcpy(&currSize,&toWrite.data[headerSize],sizeof(currSize));
-						
-						destLen = bytesPerPixel*width*height-currSize;
-						//printf("Width: %u height: %u bytesPerPixel %d currSize %u headerSize: %u\n",width,height,bytesPerPixel,currSize,headerSize);
-						temp = destLen;
-						
-						uint16_t offsetIn = 0;
-						offsetOut = 0;
-						while(1)
-						{
-							destLen = temp;
-							
-							memcpy(&compLen,&toWrite.data[headerSize+sizeof(currSize)+offsetIn],sizeof(compLen));
-							//printf("Comp len: %lu	destLen: %lu\n",compLen,destLen);
-							
-							if((headerSize+sizeof(currSize)+sizeof(compLen)+offsetIn)>=toWrite.len)
-							{
-								break;
-							}
-							
-							int error = uncompress((Bytef *)&image[currSize+offsetOut],&destLen,(Bytef *)&toWrite.data[headerSize+sizeof(currSize)+sizeof(compLen)+offsetIn],compLen);
-							
-							if(error != Z_OK)
-							{
-								switch(error)
-								{
-									case Z_MEM_ERROR:
-										printf("Compression Memory Error\n");
-										break;
-
-									case Z_BUF_ERROR:
-										printf("Compression Buffer Error\n");
-										break;
-										
-									case Z_DATA_ERROR:
-										printf("Compression Data Error\n");
-										break;
-										
-									default:
-										printf("Compression Unknown error: %d\n",error);
-										break;
-								}
-								exit(error);
-							}
-							
-							temp -= destLen;
-							offsetOut += destLen;
-							offsetIn += sizeof(compLen) + compLen;
-						}
-						
-						wasFound = 1;
-						break;
-					}
-				}
-				
-				if(wasFound)
-				{
-					wasFound = 0;
-				}
-				else
-				{
-					int shouldBreak = 0;
-					while(1)
-					{
-						int requestedSeq = nextSeq+1;
-						//printf("Requested Seq: %d\n",requestedSeq);
-						for(int x = 0;x<=count;x++)
-						{
-							if(currSizeArr[x].sequence==requestedSeq||nextSeq==highestSeq)
-							{
-								memset(&image[currSize+offsetOut],0x00,(nextSeq==highestSeq?width*height*bytesPerPixel:currSizeArr[x].size)-currSize-offsetOut);
-								shouldBreak = 1;
-								break;
-							}
-						}
-						
-						if(shouldBreak)
-						{
-							wasFound = 0;
-							break;
-						}
-						else
-						{
-							nextSeq++;
-						}
-					}
-				}
-				//printf("Seq written: %u\n",nextSeq);
-				nextSeq++;
-			}
-			free(currSizeArr);
-		}		
+			free(image);
+			free(received);
+			free(rowsReceived);
+			image = rows;
+		}
 		
 		//printf("Data extracted\n");
 		//printf("bytesperpixel %d\n",bytesPerPixel);
@@ -743,379 +2111,208 @@ int main()
 			exit(-1);
 		}
 		
-		FILE* mdatTemp  = fopen("mdatTemp", "wb+");
-		
-		if (mdatTemp == NULL) 
-		{   
-			printf("Error! Could not open mdat temporary file\n"); 
+		if(frames.firstMdat == NO_FRAME || frames.firstMoov == NO_FRAME)//Exits and cleans up if a box was lost entirely
+		{
+			printf("Error: %s data lost in transmission\n",frames.firstMoov == NO_FRAME ? "moov" : "mdat");
+			
+			fclose(file);
+			closeStore();
+			
+			del_name(intname,name_len);
+			
 			exit(-1);
 		}
 		
-		FILE* moovTemp  = fopen("moovTemp", "wb+");
+		uint32_t compLen;//Compressed size of the moov segment being gathered
 		
-		if (moovTemp == NULL) 
-		{   
-			printf("Error! Could not open moov temporary file\n"); 
-			exit(-1);
-		}
+		frame = storedFrame(frames.firstMdat);
+		uint64_t mdatSize;//Size of the mdat box contents
+		memcpy(&mdatSize,&frame->data[FRAME_HEADER_SIZE],sizeof(mdatSize));
+		uint8_t mdatHeaderSize = boxHeaderSize(mdatSize);
 		
-		uint16_t headerSize = 3;
-		char chunkName[5];
-		chunkName[4] = '\0';
-		uint32_t chunkSize;
 		
-		fseek(compTemp,0,SEEK_SET);
-		while(fread(&toWrite, sizeof(struct tempCompData), 1, compTemp))
+		////////////////////////////////
+		//Finding moov header and ftyp//
+		////////////////////////////////
+		frame = storedFrame(frames.firstMoov);
+		uint8_t moovFirst = 0;
+		memcpy(&moovFirst,&frame->data[MOOV_FIRST_OFFSET],sizeof(moovFirst));
+		if(frames.moovHeaderSize > MOOV_FIRST_OFFSET + sizeof(moovFirst))//Writes ftyp to final file if it exists
 		{
-			memcpy(chunkName,&toWrite.data[headerSize+sizeof(chunkSize)],4);
-			if(strcmp(chunkName,"mdat")==0)
-			{
-				break;
-			}
+			fwrite(&frame->data[MOOV_FIRST_OFFSET + sizeof(moovFirst)],frames.moovHeaderSize - (MOOV_FIRST_OFFSET + sizeof(moovFirst)),1,file);
 		}
+		uint64_t moovSize;//Size of the moov box contents
+		memcpy(&moovSize,&frame->data[FRAME_HEADER_SIZE],sizeof(moovSize));
 		
-		memcpy(&chunkSize,&toWrite.data[headerSize],sizeof(chunkSize));
-		headerSize += sizeof(chunkSize);
-		
-		uint32_t mdatSize = changeEndian(chunkSize);
-		
-		memcpy(chunkName,&toWrite.data[headerSize],4);
-		headerSize+=4;
-		
-		fwrite(&chunkSize,sizeof(chunkSize),1,mdatTemp);
-		fwrite("mdat",4,1,mdatTemp);
+		//Boxes are written straight to their final place in the output file
+		//A 64-bit mdat header takes the place of the wide box, as it does in files written with one, so chunk offsets in moov stay valid
+		uint32_t wideSize = (mdatHeaderSize > sizeof(uint32_t)+4 ? 0 : 4+sizeof(uint32_t));
+		off_t moovPos, widePos, mdatPos;
+		if(moovFirst != 1)
+		{
+			widePos = ftello(file);
+			mdatPos = widePos + wideSize;
+			moovPos = mdatPos + mdatHeaderSize + mdatSize;
+		}
+		else
+		{
+			moovPos = ftello(file);
+			widePos = moovPos + boxHeaderSize(moovSize) + moovSize;
+			mdatPos = widePos + wideSize;
+		}
+		if(wideSize != 0)
+		{
+			wideSize = changeEndian(wideSize);
+			fseeko(file,widePos,SEEK_SET);
+			fwrite(&wideSize,sizeof(wideSize),1,file);
+			fwrite("wide",4,1,file);
+		}
 		
 		
 		//////////////////////////
 		//Processing mdat frames//
 		//////////////////////////
-		struct sizeData* currSizeArr = malloc(sizeof(struct sizeData));
-		
-		fseek(compTemp,0,SEEK_SET);
-		int count = 1;
-		unsigned int mdatHighestSeq = 0;
-		unsigned int mdatLowestSeq = highestSeq;
-		unsigned int mdatLowestSize = 0;
-		while(fread(&toWrite, sizeof(struct tempCompData), 1, compTemp))//Makes an array of currSize's
-		{
-			memcpy(chunkName,&toWrite.data[headerSize-4],4);
-			//printf("Chunk name: %s\n",chunkName);
-			if(strcmp(chunkName,"mdat")==0)
-			{
-				if(mdatHighestSeq<toWrite.sequence)
-				{
-					mdatHighestSeq = toWrite.sequence;
-				}
-				currSizeArr = realloc(currSizeArr,count*sizeof(struct sizeData));
-				memcpy(&currSizeArr[count-1].sequence,&toWrite.sequence,sizeof(toWrite.sequence));
-				memcpy(&currSizeArr[count-1].size,&toWrite.data[headerSize],sizeof(uint32_t));
-				
-				if(mdatLowestSeq>toWrite.sequence)
-				{
-					mdatLowestSeq = toWrite.sequence;
-					memcpy(&mdatLowestSize,&toWrite.data[headerSize],sizeof(uint32_t));
-					//printf("mdatLowestSeq: %u\n",mdatLowestSeq);
-				}
-				//printf("Size: %u\n",currSizeArr[count-1].size);
-				count++;
-			}
-		}
-	
-		currSizeArr = realloc(currSizeArr,count*sizeof(struct sizeData));//Adds fake entry for when the last frame is not received
-		uint16_t tempSeq = mdatHighestSeq+1;
-		memcpy(&currSizeArr[count-1].sequence,&tempSeq,sizeof(toWrite.sequence));
-		uint32_t tempSize = changeEndian(chunkSize);
-		memcpy(&currSizeArr[count-1].size,&tempSize,sizeof(tempSize));
-		
-		//printf("mdatHighestSeq: %u mdatLowestSeq: %u\n",mdatHighestSeq,mdatLowestSeq);
-		
-		count -= 1;
-		headerSize += sizeof(uint32_t);
-		
-		if(mdatLowestSize!=0)
-		{
-			mdatLowestSeq -= 1;
-		}
+		fseeko(file,mdatPos,SEEK_SET);
+		writeBoxHeader(file,"mdat",mdatSize);
+		uint64_t mdatWritten = 0;//Bytes of the mdat box contents written so far
 		
-		expectedSize += tempSize;
+		//mdat frames are cut at sample boundaries, so missing data is counted as frames of at most BUFFER_SIZE-MDAT_HEADER_SIZE bytes
+		uint32_t mdatFrameData = BUFFER_SIZE-MDAT_HEADER_SIZE;
+		uint64_t mdatMissing = 0;//Bytes of the mdat box contents no frame was received for
 		
-		int32_t nextSeq = mdatLowestSeq;
-		uint8_t hasFinished = 0;//Changes to 1 when chunk has ended
-		uint8_t frameFound = 0;//Changes to 1 when frame is found
-		uint32_t currSize = 0;
-		uint16_t dataSize = 0;
-
-		while(hasFinished == 0||currSize+toWrite.len == tempSize)
+		//Missing data is skipped over rather than written so it is left as a hole in the file, which reads back as 0x00
+		for(uint32_t x = 0;x<frames.mdatCount;x++)//Writes frames in the order of their data
 		{
-			//printf("Current Seq %d\n",nextSeq);
-			fseek(compTemp,0,SEEK_SET);
-			while(fread(&toWrite, sizeof(struct tempCompData), 1, compTemp))//Scans temp file for data associated with nextSeq
+			frame = storedFrame(frames.mdat[x].sequence);
+			uint64_t offset = frames.mdat[x].size;//Position of the frame data in the mdat box contents
+			uint16_t dataSize = frame->len-MDAT_HEADER_SIZE;
+			expectedSize += frame->len;
+			if(offset < mdatWritten || offset > mdatSize || dataSize > mdatSize-offset)//Overlaps data already written, such as a keyframe copy, or runs past the box
 			{
-				//printf("Sequence Read: %d\n",toWrite.sequence);
-				if(toWrite.sequence == nextSeq)
-				{	
-					frameFound = 1;
-					memcpy(chunkName,&toWrite.data[headerSize-sizeof(uint32_t)-4],4);
-					if(strcmp(chunkName,"mdat")==0)
-					{
-						memcpy(&currSize,&toWrite.data[headerSize-sizeof(uint32_t)],sizeof(currSize));
-						//printf("CurrSize read: %u\n",currSize);
-						
-						fwrite(&toWrite.data[headerSize],toWrite.len-headerSize,1,mdatTemp);
-						
-						dataSize = toWrite.len-headerSize;
-					}
-					break;
-				}
+				continue;
 			}
 			
-			if(frameFound == 1)
+			if(offset != mdatWritten)
 			{
-				frameFound = 0;
+				mdatMissing += offset-mdatWritten;
+				fseeko(file,mdatPos+mdatHeaderSize+offset,SEEK_SET);
 			}
-			else
-			{
-				int shouldBreak = 0;
-				while(1)//Loops until correct amount of missing data is found and is written to temp file
-				{
-					uint16_t requestedSeq = nextSeq+1;
-					//printf("Requested Seq: %d\n",requestedSeq);
-					for(int x = 0;x<=count;x++)
-					{
-						//printf("currSize: %u\n",currSizeArr[x].sequence);
-						char hexZero = 0x00;
-						uint32_t numZeros;
-						if(currSizeArr[x].sequence==requestedSeq)
-						{
-							numZeros = currSizeArr[x].size-(currSize+dataSize);
-							//printf("numZeros: %u currSizearr: %u seq: %u currSize: %u dataSize: %u requestedSeq: %u nextSeq: %u\n",numZeros,currSizeArr[x].size,currSizeArr[x].sequence,currSize,dataSize,requestedSeq,nextSeq);
-							for(int y = 0;y<numZeros;y++)
-							{
-								fwrite(&hexZero,sizeof(hexZero),1,mdatTemp);
-							}
-							shouldBreak = 1;
-							break;
-						}
-						if(requestedSeq>mdatHighestSeq)
-						{
-							numZeros = tempSize;
-							for(int y = 0;y<numZeros;y++)
-							{
-								fwrite(&hexZero,sizeof(hexZero),1,mdatTemp);
-							}
-							shouldBreak = 1;
-							break;
-						}
-					}
-					
-					if(shouldBreak)
-					{
-						if(requestedSeq > mdatHighestSeq)
-						{
-							hasFinished =1;
-						}
-						frameFound = 0;
-						break;
-					}
-					else
-					{
-						nextSeq++;
-					}
-				}
-			}	
-			nextSeq++;
-			expectedSize += headerSize;
+			fwrite(&frame->data[MDAT_HEADER_SIZE],dataSize,1,file);
+			mdatWritten = offset + dataSize;
+		}
+		mdatMissing += mdatSize-mdatWritten;
+		expectedSize += mdatMissing + MDAT_HEADER_SIZE*((mdatMissing+mdatFrameData-1)/mdatFrameData);
+		fflush(file);
+		if(ftruncate(fileno(file),mdatPos+mdatHeaderSize+mdatSize) != 0)//Extends the file over any missing data at the end of the mdat box
+		{
+			printf("Error! Could not extend file\n");
+			fclose(file);
+			closeStore();
+			del_name(intname,name_len);
+			exit(-1);
 		}
-		free(currSizeArr);
 		
 		
 		//////////////////////////
 		//Processing moov frames//
 		//////////////////////////
-		uLongf destLen, compLen;
-		
-		headerSize = 3 + sizeof(chunkSize);
-		uint8_t moovFirst = 0;
-		fseek(compTemp,0,SEEK_SET);
-		while(fread(&toWrite, sizeof(struct tempCompData), 1, compTemp))//Searches for ftyp and writes to final file if exists
+		//Every MOOV_SEGMENT bytes of moov are an independent stream, decoded once all of its frames are gathered from either copy
+		uint16_t headerSize = frames.moovHeaderSize + sizeof(uint32_t) + 2 + 2*sizeof(uint32_t);//Offset of the compressed moov data in every moov frame, after subSeq, the codec, the number of moov copies, the segment and its compressed size
+		off_t moovDataPos = moovPos + boxHeaderSize(moovSize);
+		uint32_t segmentCount = (moovSize+MOOV_SEGMENT-1)/MOOV_SEGMENT;
+		uint32_t segmentsDecoded = 0;
+		Bytef* segmentDat = NULL;//Compressed data of the segment being gathered
+		uint32_t segmentSlots = 0;
+		Bytef* decompDat = malloc(MOOV_SEGMENT);
+		if(decompDat == NULL)
 		{
-			memcpy(chunkName,&toWrite.data[headerSize],4);
-			if(strcmp(chunkName,"moov")==0)
-			{
-				headerSize += 4;
-				
-				memcpy(&moovFirst,&toWrite.data[headerSize],sizeof(moovFirst));
-				headerSize += sizeof(moovFirst);
-				
-				memcpy(chunkName,&toWrite.data[headerSize+sizeof(chunkSize)],4);
-				if(strcmp(chunkName,"ftyp")==0)
-				{
-					memcpy(&chunkSize,&toWrite.data[headerSize],sizeof(chunkSize));
-					
-					chunkSize = changeEndian(chunkSize);
-					
-					fwrite(&toWrite.data[headerSize],chunkSize,1,file);
-					headerSize += chunkSize;
-				}
-				
-				memcpy(&chunkSize,&toWrite.data[3],sizeof(chunkSize));//Copies moov chunk size to chunkSize
-				break;
-			}
+			printf("Error! Could not allocate moov buffer\n");
+			exit(-1);
 		}
-		
-		
-		uint32_t highestSubSeq = 0, subSeq;
+		uint32_t segment = UINT32_MAX;
+		uint32_t segmentHave = 0;//Compressed bytes of segment gathered so far
 		compLen = 0;
 		
-		fseek(compTemp,0,SEEK_SET);
-		while(fread(&toWrite, sizeof(struct tempCompData), 1, compTemp))//Find highest sub sequence
+		for(uint32_t x = 0;x < frames.moovCount;x++)//Gathers compressed moov data in order
 		{
-			memcpy(chunkName,&toWrite.data[3 + sizeof(chunkSize)],4);
-			if(strcmp(chunkName,"moov")==0)
+			frame = storedFrame(frames.moov[x]);
+			if(frame == NULL || frame->len < headerSize)
 			{
-				memcpy(&subSeq,&toWrite.data[headerSize],sizeof(highestSubSeq));
-				if(highestSubSeq<subSeq)
-				{
-					highestSubSeq = subSeq;
-				}
+				continue;
 			}
-		}
-		Bytef* moovDat = malloc(BUFFER_SIZE*(highestSubSeq+1));
-		//printf("Highest sub seq: %u\n",highestSubSeq);
-		
-		for(uint32_t x = 0;x <= highestSubSeq;x++)//Writes moov data to temp file
-		{
-			fseek(compTemp,0,SEEK_SET);
-			while(fread(&toWrite, sizeof(struct tempCompData), 1, compTemp))
+			expectedSize += frame->len*(uint8_t)frame->data[frames.moovHeaderSize+sizeof(uint32_t)+1];//Copies the sender sent of moov, once with erasure coding on and twice without
+			
+			uint32_t frameSegment, frameCompLen;
+			memcpy(&frameSegment,&frame->data[headerSize-2*sizeof(uint32_t)],sizeof(frameSegment));
+			memcpy(&frameCompLen,&frame->data[headerSize-sizeof(uint32_t)],sizeof(frameCompLen));
+			if(frameSegment >= segmentCount)
+			{
+				continue;
+			}
+			if(frameSegment != segment)//First frame received of a segment
 			{
-				memcpy(chunkName,&toWrite.data[3 + sizeof(chunkSize)],4);
-				//printf("%s\n",chunkName);
-				if(strcmp(chunkName,"moov")==0)
+				segment = frameSegment;
+				compLen = frameCompLen;
+				segmentHave = 0;
+				if(compLen > segmentSlots)
 				{
-					memcpy(&subSeq,&toWrite.data[headerSize],sizeof(subSeq));
-					//printf("%u\n",subSeq);
-					if(subSeq == x)
+					segmentDat = realloc(segmentDat,compLen);
+					segmentSlots = compLen;
+					if(segmentDat == NULL)
 					{
-						memcpy(&moovDat[compLen],&toWrite.data[headerSize + sizeof(subSeq)],toWrite.len-(headerSize+4));
-						
-						compLen += toWrite.len-(headerSize + sizeof(subSeq));
-						
-						//printf("%d\n",toWrite.len-(headerSize + sizeof(subSeq)));
-						expectedSize += toWrite.len*2;
-						break;
+						printf("Error! Could not allocate moov buffer\n");
+						exit(-1);
 					}
 				}
 			}
-		}
-		
-		//Printing calculated loss
-		//NOTE: Loss will not be accurate if either moov and mdat data is completely lost
-		printf("Loss: %f%%\n",((1-(double)receivedSize/expectedSize))*100);
-		
-		//Decompression of moov data
-		destLen = changeEndian(chunkSize) - sizeof(chunkSize) - 4;
-		Bytef* decompDat = malloc(destLen);
-		
-		//printf("CompLen: %lu destLen: %lu\n",compLen,destLen);
-
-		uLongf tempLen = destLen;
-		int error = uncompress(decompDat,&destLen,moovDat,compLen);
-		
-		if(destLen != tempLen)//Exits and cleans up if there is missing moov data
-		{
-			printf("Error: moov data lost in transmission\n");
-			
-			fclose(mdatTemp);
-			fclose(moovTemp);
-			
-			if(remove("mdatTemp")!=0)
-			{
-				printf("Error: unable to delete mdat temporary file\n");
-			}
-			
-			if(remove("moovTemp")!=0)
-			{
-				printf("Error: unable to delete moov temporary file\n");
-			}
-			
-			fclose(compTemp);
-	
-			del_name(intname,name_len);
-			
-			if(remove("compTemp")!=0)
+			uint16_t dataLen = frame->len-headerSize;
+			if(frameCompLen != compLen || dataLen > compLen-segmentHave)
 			{
-				printf("Error: unable to delete compressed temporary file\n");
+				continue;
 			}
+			memcpy(&segmentDat[segmentHave],&frame->data[headerSize],dataLen);
+			segmentHave += dataLen;
 			
-			exit(-1);
-		}
-		
-		if(error != Z_OK)
-		{
-			switch(error)
+			if(segmentHave == compLen)//A lost frame leaves the segment short, so it is only decoded whole
 			{
-				case Z_MEM_ERROR:
-					printf("Compression Memory Error\n");
-					break;
-
-				case Z_BUF_ERROR:
-					printf("Compression Buffer Error\n");
-					break;
-					
-				case Z_DATA_ERROR:
-					printf("Compression Data Error\n");
-					break;
-					
-				default:
-					printf("Compression Unknown error: %d\n",error);
-					break;
+				uint32_t segmentLen = (moovSize-(uint64_t)segment*MOOV_SEGMENT < MOOV_SEGMENT ? moovSize-(uint64_t)segment*MOOV_SEGMENT : MOOV_SEGMENT);
+				uint8_t codec = frame->data[frames.moovHeaderSize+sizeof(uint32_t)];
+				uint32_t inUsed, outUsed = 0;
+				int error = codecDecompress(codec,segmentDat,compLen,&inUsed,decompDat,segmentLen,&outUsed);
+				if(error == Z_OK && outUsed == segmentLen)
+				{
+					fseeko(file,moovDataPos+(off_t)segment*MOOV_SEGMENT,SEEK_SET);
+					fwrite(decompDat,segmentLen,1,file);
+					segmentsDecoded++;
+				}
 			}
-			fclose(mdatTemp);
-			fclose(moovTemp);
-			fclose(compTemp);
-			exit(error);
 		}
-		
-		free(moovDat);
-		
-		fwrite(&chunkSize,sizeof(chunkSize),1,moovTemp);
-		uint32_t moovSize = changeEndian(chunkSize);
-		fwrite("moov",4,1,moovTemp);
-		fwrite(decompDat,destLen,1,moovTemp);
-		
+		free(segmentDat);
 		free(decompDat);
 		
-		//Putting all data in correct order in a single file
-		uint32_t wideSize = 4+sizeof(uint32_t);
-		wideSize = changeEndian(wideSize);
-		if(moovFirst != 1)
-		{
-			fwrite(&wideSize,sizeof(wideSize),1,file);
-			fwrite("wide",4,1,file);
-			copyFile(file,mdatTemp,mdatSize);
-			copyFile(file,moovTemp,moovSize);
-		}
-		else
-		{
-			copyFile(file,moovTemp,moovSize);
-			fwrite(&wideSize,sizeof(wideSize),1,file);
-			fwrite("wide",4,1,file);
-			copyFile(file,mdatTemp,mdatSize);
-		}	
-		
-		fclose(mdatTemp);
-		fclose(moovTemp);
+		//Printing calculated loss
+		//NOTE: Loss will not be accurate if either moov and mdat data is completely lost, and lost copies of keyframe data are not counted
+		printf("Loss: %f%%\n",((1-(double)receivedSize/expectedSize))*100);
 		
-		if(remove("mdatTemp")!=0)
+		//Lost segments are left as holes in the moov box, like missing mdat data
+		if(segmentsDecoded != segmentCount)
 		{
-			printf("Error: unable to delete mdat temporary file\n");
+			printf("Error: %u of %u moov segments lost in transmission\n",segmentCount-segmentsDecoded,segmentCount);
 		}
 		
-		if(remove("moovTemp")!=0)
+		fseeko(file,moovPos,SEEK_SET);
+		writeBoxHeader(file,"moov",moovSize);
+		fflush(file);
+		if(moovFirst != 1 && ftruncate(fileno(file),moovDataPos+moovSize) != 0)//Extends the file over any missing data at the end of the moov box
 		{
-			printf("Error: unable to delete moov temporary file\n");
+			printf("Error! Could not extend file\n");
+			fclose(file);
+			closeStore();
+			del_name(intname,name_len);
+			exit(-1);
 		}
 		
+		fclose(file);
 	}
 	
 	//If file type is not found then do general receive
@@ -1129,33 +2326,70 @@ int main()
 			exit(-1);
 		}
 		
-		int nextSeq = 0;
-		while(nextSeq<=highestSeq)
+		//Frames are written at the offset they carry, so missing frames are left as holes in the file
+		uint64_t filePos = 0;//Position just past the last frame written
+		uint64_t fileSize = 0;//Size of the sent file, carried by every frame
+		unsigned char* fileData = NULL;//Decompressed data of the current frame
+		uint32_t fileDataSize = 0;
+		for(uint32_t x = 0;x<frames.receivedCount;x++)
 		{
-			//printf("Current Seq %d\n",nextSeq);
-			fseek(compTemp,0,SEEK_SET);
-			while(fread(&toWrite, sizeof(struct tempCompData), 1, compTemp))//Scans temp file for data associated with nextSeq
+			frame = storedFrame(frames.received[x]);
+			if(frame->len < GEN_HEADER_SIZE)
+			{
+				continue;
+			}
+			
+			uint64_t offset;
+			uint32_t dataLen;
+			memcpy(&offset,&frame->data[FRAME_HEADER_SIZE],sizeof(offset));
+			memcpy(&dataLen,&frame->data[FRAME_HEADER_SIZE+sizeof(offset)],sizeof(dataLen));
+			if(dataLen > FRAME_DATA_MAX)//More than the sender ever packs into one frame, so the frame is corrupt
+			{
+				continue;
+			}
+			memcpy(&fileSize,&frame->data[FRAME_HEADER_SIZE+sizeof(offset)+sizeof(dataLen)],sizeof(fileSize));
+			if(dataLen > fileDataSize)
 			{
-				//printf("Sequence Read: %d\n",toWrite.sequence);
-				if(toWrite.sequence == nextSeq)
+				free(fileData);
+				fileDataSize = dataLen;
+				fileData = malloc(fileDataSize);
+				if(fileData == NULL)
 				{
-					fwrite(&toWrite.data,toWrite.len,1,file);
-					break;
+					printf("Error! Could not allocate decompression buffer\n");
+					exit(-1);
 				}
 			}
-			nextSeq++;
+			if(decodeStreams(frame,GEN_HEADER_SIZE,frame->data[GEN_HEADER_SIZE-1],fileData,dataLen,&dataLen) != Z_OK)
+			{
+				continue;//Left as a hole like a lost frame
+			}
+			
+			if(offset != filePos)
+			{
+				fseeko(file,offset,SEEK_SET);
+			}
+			fwrite(fileData,dataLen,1,file);
+			filePos = offset + dataLen;
+		}
+		free(fileData);
+		
+		fflush(file);
+		if(fileSize > filePos && ftruncate(fileno(file),fileSize) != 0)//Extends the file over any missing data at its end
+		{
+			printf("Error! Could not extend file\n");
+			fclose(file);
+			closeStore();
+			del_name(intname,name_len);
+			exit(-1);
 		}
 		fclose(file);
 	}
 	
-	fclose(compTemp);
+	freeFrameIndex();
+	closeStore();
+	releaseCodecs();
 	
 	del_name(intname,name_len);
-	
-	if(remove("compTemp")!=0)
-	{
-		printf("Error: unable to delete compressed temporary file\n");
-	}
 
 	return 0;
 }
\ No newline at end of file
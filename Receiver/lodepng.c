@@ -3614,6 +3614,11 @@ static void Adam7_getpassvalues(unsigned passw[7], unsigned passh[7], size_t fil
   }
 }
 
+void lodepng_adam7_passes(unsigned passw[7], unsigned passh[7], size_t passstart[8], unsigned w, unsigned h, unsigned bpp) {
+  size_t filter_passstart[8], padded_passstart[8];
+  Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
+}
+
 #ifdef LODEPNG_COMPILE_DECODER
 
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -3742,6 +3747,11 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   return 0;
 }
 
+unsigned lodepng_unfilter_scanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                   size_t bytewidth, unsigned char filterType, size_t length) {
+  return unfilterScanline(recon, scanline, precon, bytewidth, filterType, length);
+}
+
 static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp) {
   /*
   For PNG filter method 0
@@ -3822,6 +3832,10 @@ static void Adam7_deinterlace(unsigned char* out, const unsigned char* in, unsig
   }
 }
 
+void lodepng_adam7_deinterlace(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp) {
+  Adam7_deinterlace(out, in, w, h, bpp);
+}
+
 static void removePaddingBits(unsigned char* out, const unsigned char* in,
                               size_t olinebits, size_t ilinebits, unsigned h) {
   /*
@@ -4979,6 +4993,11 @@ static void filterScanline(unsigned char* out, const unsigned char* scanline, co
   }
 }
 
+void lodepng_filter_scanline(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                             size_t length, size_t bytewidth, unsigned char filterType) {
+  filterScanline(out, scanline, prevline, length, bytewidth, filterType);
+}
+
 /* log2 approximation. A slight bit faster than std::log. */
 static float flog2(float f) {
   float result = 0;
@@ -5246,6 +5265,10 @@ static void Adam7_interlace(unsigned char* out, const unsigned char* in, unsigne
   }
 }
 
+void lodepng_adam7_interlace(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp) {
+  Adam7_interlace(out, in, w, h, bpp);
+}
+
 /*out must be buffer big enough to contain uncompressed IDAT chunk data, and in must contain the full image.
 return value is error**/
 static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const unsigned char* in,
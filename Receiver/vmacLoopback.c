@@ -0,0 +1,552 @@
+//Loopback V-MAC - shared by the sender and receiver, both copies must stay identical
+//Stands in for vmac.a on one machine so the programs can be measured without the radio. Frames travel between processes as
+//datagrams on AF_UNIX sockets in one directory, through a link model with a bandwidth limit and driver queue, Bernoulli or
+//Gilbert-Elliott loss, delay, jitter and reordering. The model is set from VMAC_LOOP_ environment variables so the programs
+//and their prompts are unchanged. Built in place of vmac.a with make sendmake VMAC=vmacLoopback.c and likewise for recvmake
+//
+//VMAC_LOOP_DIR : Directory of the processes' sockets, LOOP_DIR by default. Every process in it hears every other.
+//VMAC_LOOP_RATE : Link rate in kbit/s, 0 or unset for no limit.
+//VMAC_LOOP_QUEUE : Frames the link holds while they wait to go out at its rate, LOOP_QUEUE by default. More are dropped.
+//VMAC_LOOP_LOSS : Chance of losing each frame.
+//VMAC_LOOP_GE : "toBad toGood lossGood lossBad", Gilbert-Elliott loss in place of VMAC_LOOP_LOSS. Each frame the link moves
+//               from its good state to its bad one with chance toBad, or back with chance toGood, then loses the frame with
+//               the chance of its state.
+//VMAC_LOOP_DELAY : One-way delay in ms.
+//VMAC_LOOP_JITTER : Most random delay in ms added to each frame on top, which reorders frames closer together than it.
+//VMAC_LOOP_REORDER : "chance ms", holds a frame back ms more with the given chance so later frames overtake it.
+//VMAC_LOOP_SEED : Seed of the loss and delay draws, so runs can be repeated.
+//The model applies to the frames a process sends, so it is normally set for the sender only.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define LOOP_DIR "/tmp/vmacLoop" //Directory of the processes' sockets, overridden by VMAC_LOOP_DIR
+#define LOOP_QUEUE 64 //Frames the link holds waiting to go out at its rate, overridden by VMAC_LOOP_QUEUE
+#define LOOP_PEER_SCAN 200 //Milliseconds between scans of the socket directory for processes started or stopped since
+#define LOOP_MAX_PEERS 32 //Most other processes frames are sent to
+#define LOOP_MAX_NAMES 16 //Most interest names one process can register
+#define LOOP_FRAME_MAX 4096 //Longest frame, with its interest name and the loopback header
+#define LOOP_SEND_TIMEOUT 1 //Seconds a send to a process that has stopped reading waits before the frame is dropped
+
+//Loopback header, followed by the interest name then the frame
+struct loopHeader
+{
+	uint16_t type;
+	uint16_t seq;
+	uint16_t nameLen;
+	uint16_t len;
+};
+
+//Frame on its way across the link
+struct loopFrame
+{
+	long long due;//Monotonic time(ns) the frame reaches the other processes
+	uint64_t order;//Order frames were sent in, so frames due at the same time arrive in it
+	uint16_t size;//Bytes of data
+	char data[];//Loopback header, name and frame
+};
+
+//Link model and frames in flight, shared by send_vmac and the link thread
+struct loopLink
+{
+	pthread_mutex_t lock;
+	pthread_cond_t changed;//Signalled when a frame is added or delivered
+	struct loopFrame** heap;//Frames in flight, a binary heap ordered by due
+	uint32_t count;
+	uint32_t slots;
+	uint64_t order;
+	uint32_t delivering;//Frames taken off the heap but not yet sent to every process
+
+	double rate;//Bytes per ns, 0 for no limit
+	long long* departures;//Times frames waiting for the link finish going out, oldest first, a ring of queueMax
+	uint32_t queueMax;
+	uint32_t queueHead;
+	uint32_t queueCount;
+	long long linkFree;//Time the last frame queued finishes going out
+
+	double toBad, toGood, lossGood, lossBad;
+	uint8_t bad;//1 while Gilbert-Elliott loss is in its bad state
+	long long delay, jitter, reorderDelay;//ns
+	double reorder;
+	uint64_t random;//xorshift64 state
+
+	uint64_t sent, lost, queueDrops, peerDrops;
+}channel = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+//Sockets of this process and the others it sends to
+struct loopPeers
+{
+	int fd;
+	struct sockaddr_un self;
+	struct sockaddr_un peer[LOOP_MAX_PEERS];
+	uint32_t count;
+	long long scanned;//Monotonic time(ns) of the last directory scan
+	char dir[sizeof(((struct sockaddr_un*)0)->sun_path)-16];
+	void (*callback)(uint8_t, uint64_t, char*, uint16_t, uint16_t, char*, uint16_t);
+	char names[LOOP_MAX_NAMES][256];//Interest names registered by send_vmac, data frames under others are ignored
+	uint16_t nameLen[LOOP_MAX_NAMES];
+	uint16_t seq;
+}peers = {.fd = -1};
+
+pthread_t loopLinkThread, loopRecvThread;
+
+/**
+ *  loopNow  - Monotonic clock in ns
+ */
+long long loopNow()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return (long long)now.tv_sec*1000000000 + now.tv_nsec;
+}
+
+/**
+ *  loopRandom  - Uniform draw in [0,1) from the link's generator
+ */
+double loopRandom()
+{
+	channel.random ^= channel.random<<13;
+	channel.random ^= channel.random>>7;
+	channel.random ^= channel.random<<17;
+	return (channel.random>>11)*(1.0/9007199254740992.0);
+}
+
+/**
+ *  loopEnv  - Numeric setting
+ *
+ *  Returns the environment variable as a number, or fallback if it is not set.
+ */
+double loopEnv(const char* name, double fallback)
+{
+	const char* value = getenv(name);
+	return (value != NULL ? atof(value) : fallback);
+}
+
+/**
+ *  loopEarlier  - Heap order of two frames in flight
+ */
+int loopEarlier(struct loopFrame* a, struct loopFrame* b)
+{
+	return (a->due < b->due || (a->due == b->due && a->order < b->order));
+}
+
+/**
+ *  loopPush  - Adds a frame to the heap of frames in flight
+ *
+ *  Called with channel.lock held.
+ */
+void loopPush(struct loopFrame* frame)
+{
+	if(channel.count == channel.slots)
+	{
+		channel.slots = (channel.slots != 0 ? 2*channel.slots : 1024);
+		channel.heap = realloc(channel.heap,channel.slots*sizeof(struct loopFrame*));
+		if(channel.heap == NULL)
+		{
+			pthread_mutex_unlock(&channel.lock);
+			printf("Error! Could not allocate loopback link\n");
+			exit(-1);
+		}
+	}
+	uint32_t x = channel.count++;
+	while(x > 0 && loopEarlier(frame,channel.heap[(x-1)/2]))
+	{
+		channel.heap[x] = channel.heap[(x-1)/2];
+		x = (x-1)/2;
+	}
+	channel.heap[x] = frame;
+}
+
+/**
+ *  loopPop  - Takes the frame due first off the heap of frames in flight
+ */
+struct loopFrame* loopPop()
+{
+	struct loopFrame* first = channel.heap[0];
+	struct loopFrame* last = channel.heap[--channel.count];
+	uint32_t x = 0;
+	while(2*x+1 < channel.count)
+	{
+		uint32_t child = 2*x+1;
+		if(child+1 < channel.count && loopEarlier(channel.heap[child+1],channel.heap[child]))
+		{
+			child++;
+		}
+		if(!loopEarlier(channel.heap[child],last))
+		{
+			break;
+		}
+		channel.heap[x] = channel.heap[child];
+		x = child;
+	}
+	channel.heap[x] = last;
+	return first;
+}
+
+/**
+ *  loopScanPeers  - Finds the other processes
+ *
+ *  Lists every socket in the directory but this process's own.
+ */
+void loopScanPeers()
+{
+	peers.count = 0;
+	DIR* dir = opendir(peers.dir);
+	if(dir == NULL)
+	{
+		return;
+	}
+	struct dirent* entry;
+	while((entry = readdir(dir)) != NULL && peers.count < LOOP_MAX_PEERS)
+	{
+		struct sockaddr_un* peer = &peers.peer[peers.count];
+		if(entry->d_name[0] == '.')
+		{
+			continue;
+		}
+		peer->sun_family = AF_UNIX;
+		if(snprintf(peer->sun_path,sizeof(peer->sun_path),"%s/%s",peers.dir,entry->d_name) >= (int)sizeof(peer->sun_path) || strcmp(peer->sun_path,peers.self.sun_path) == 0)
+		{
+			continue;
+		}
+		peers.count++;
+	}
+	closedir(dir);
+	peers.scanned = loopNow();
+}
+
+/**
+ *  loopDeliver  - Sends a frame to every other process
+ *
+ *  Sockets of processes that have exited are removed so later scans skip them. A process that stops reading for
+ *	LOOP_SEND_TIMEOUT misses the frame.
+ */
+void loopDeliver(struct loopFrame* frame)
+{
+	if(loopNow()-peers.scanned > LOOP_PEER_SCAN*1000000LL)
+	{
+		loopScanPeers();
+	}
+	for(uint32_t x = 0;x<peers.count;x++)
+	{
+		if(sendto(peers.fd,frame->data,frame->size,0,(struct sockaddr*)&peers.peer[x],sizeof(peers.peer[x])) >= 0)
+		{
+			continue;
+		}
+		if(errno == ECONNREFUSED || errno == ENOENT)
+		{
+			unlink(peers.peer[x].sun_path);
+			peers.peer[x--] = peers.peer[--peers.count];
+		}
+		else
+		{
+			pthread_mutex_lock(&channel.lock);
+			channel.peerDrops++;
+			pthread_mutex_unlock(&channel.lock);
+		}
+	}
+}
+
+/**
+ *  loopLinkWorker  - Link thread
+ *
+ *  Sleeps until the frame due first arrives and delivers it.
+ */
+void* loopLinkWorker(void* arg)
+{
+	pthread_mutex_lock(&channel.lock);
+	while(1)
+	{
+		if(channel.count == 0)
+		{
+			pthread_cond_wait(&channel.changed,&channel.lock);
+			continue;
+		}
+		long long due = channel.heap[0]->due;
+		if(due > loopNow())
+		{
+			struct timespec until = {.tv_sec = due/1000000000, .tv_nsec = due%1000000000};
+			pthread_cond_timedwait(&channel.changed,&channel.lock,&until);
+			continue;
+		}
+		struct loopFrame* frame = loopPop();
+		channel.delivering++;
+		pthread_mutex_unlock(&channel.lock);
+
+		loopDeliver(frame);
+		free(frame);
+
+		pthread_mutex_lock(&channel.lock);
+		channel.delivering--;
+		pthread_cond_broadcast(&channel.changed);
+	}
+	return NULL;
+}
+
+/**
+ *  loopRecvWorker  - Receive thread
+ *
+ *  Hands every frame from another process to the registered callback, like the V-MAC receive path. Data frames are only
+ *	passed on under an interest name this process has registered.
+ */
+void* loopRecvWorker(void* arg)
+{
+	char buff[LOOP_FRAME_MAX];
+	while(1)
+	{
+		ssize_t size = recv(peers.fd,buff,sizeof(buff),0);
+		struct loopHeader header;
+		if(size < (ssize_t)sizeof(header))
+		{
+			continue;
+		}
+		memcpy(&header,buff,sizeof(header));
+		if(sizeof(header)+header.nameLen+header.len != (size_t)size)
+		{
+			continue;
+		}
+		char* name = &buff[sizeof(header)];
+
+		int wanted = (header.type != 1);
+		pthread_mutex_lock(&channel.lock);
+		for(int x = 0;x<LOOP_MAX_NAMES && !wanted;x++)
+		{
+			wanted = (peers.nameLen[x] != 0 && peers.nameLen[x] == header.nameLen && memcmp(peers.names[x],name,header.nameLen) == 0);
+		}
+		pthread_mutex_unlock(&channel.lock);
+		if(wanted && peers.callback != NULL)
+		{
+			peers.callback(header.type,0,&name[header.nameLen],header.len,header.seq,name,header.nameLen);
+		}
+	}
+	return NULL;
+}
+
+/**
+ *  loopClose  - Exit handler
+ *
+ *  Waits for the frames still in flight to arrive, so a sender that returns straight after its last send_vmac loses
+ *	nothing the model did not drop, then removes this process's socket and prints what the link did.
+ */
+void loopClose()
+{
+	pthread_mutex_lock(&channel.lock);
+	while(channel.count != 0 || channel.delivering != 0)
+	{
+		pthread_cond_wait(&channel.changed,&channel.lock);
+	}
+	if(channel.sent != 0)
+	{
+		fprintf(stderr,"Loopback V-MAC: %llu frames sent, %llu lost by the loss model, %llu dropped by the full link queue, %llu missed by a process not reading\n",
+			(unsigned long long)channel.sent,(unsigned long long)channel.lost,(unsigned long long)channel.queueDrops,(unsigned long long)channel.peerDrops);
+	}
+	pthread_mutex_unlock(&channel.lock);
+	unlink(peers.self.sun_path);
+}
+
+/**
+ *  vmac_register  - Starts the loopback V-MAC
+ *
+ *  Creates this process's socket in the loopback directory, reads the link model from the environment and starts the
+ *	link and receive threads.
+ *
+ *	Arguments :
+ *	@ptr : Callback for received frames, with the signature of recv_frame.
+ */
+void vmac_register(void* ptr)
+{
+	peers.callback = ptr;
+	const char* dir = getenv("VMAC_LOOP_DIR");
+	snprintf(peers.dir,sizeof(peers.dir),"%s",dir != NULL ? dir : LOOP_DIR);
+	mkdir(peers.dir,0777);
+
+	peers.fd = socket(AF_UNIX,SOCK_DGRAM,0);
+	peers.self.sun_family = AF_UNIX;
+	snprintf(peers.self.sun_path,sizeof(peers.self.sun_path),"%s/%ld",peers.dir,(long)getpid());
+	unlink(peers.self.sun_path);
+	if(peers.fd < 0 || bind(peers.fd,(struct sockaddr*)&peers.self,sizeof(peers.self)) != 0)
+	{
+		printf("Error! Could not open loopback socket in %s\n",peers.dir);
+		exit(-1);
+	}
+	struct timeval timeout = {.tv_sec = LOOP_SEND_TIMEOUT, .tv_usec = 0};
+	setsockopt(peers.fd,SOL_SOCKET,SO_SNDTIMEO,&timeout,sizeof(timeout));
+	loopScanPeers();
+
+	channel.rate = loopEnv("VMAC_LOOP_RATE",0)*1000/8/1e9;
+	channel.queueMax = loopEnv("VMAC_LOOP_QUEUE",LOOP_QUEUE);
+	if(channel.queueMax == 0)
+	{
+		channel.queueMax = 1;
+	}
+	channel.departures = malloc(channel.queueMax*sizeof(long long));
+	channel.lossGood = loopEnv("VMAC_LOOP_LOSS",0);
+	const char* ge = getenv("VMAC_LOOP_GE");
+	if(ge != NULL && sscanf(ge,"%lf %lf %lf %lf",&channel.toBad,&channel.toGood,&channel.lossGood,&channel.lossBad) != 4)
+	{
+		printf("Error! VMAC_LOOP_GE must be \"toBad toGood lossGood lossBad\"\n");
+		exit(-1);
+	}
+	channel.delay = loopEnv("VMAC_LOOP_DELAY",0)*1000000;
+	channel.jitter = loopEnv("VMAC_LOOP_JITTER",0)*1000000;
+	const char* reorder = getenv("VMAC_LOOP_REORDER");
+	double reorderMs = 0;
+	if(reorder != NULL && sscanf(reorder,"%lf %lf",&channel.reorder,&reorderMs) != 2)
+	{
+		printf("Error! VMAC_LOOP_REORDER must be \"chance ms\"\n");
+		exit(-1);
+	}
+	channel.reorderDelay = reorderMs*1000000;
+	channel.random = (uint64_t)loopEnv("VMAC_LOOP_SEED",1)*0x9E3779B97F4A7C15ull+1;
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr,CLOCK_MONOTONIC);
+	pthread_cond_init(&channel.changed,&attr);
+	pthread_condattr_destroy(&attr);
+	if(channel.departures == NULL || pthread_create(&loopLinkThread,NULL,loopLinkWorker,NULL) != 0 || pthread_create(&loopRecvThread,NULL,loopRecvWorker,NULL) != 0)
+	{
+		printf("Error! Could not start loopback V-MAC\n");
+		exit(-1);
+	}
+	atexit(loopClose);
+}
+
+/**
+ *  send_vmac  - Sends a frame over the loopback link
+ *
+ *  Runs the frame through the loss model, queues it for the link at its rate, dropping it if LOOP_QUEUE frames are
+ *	already waiting, and gives it its delay. Returns without waiting for it to arrive. An interest(type 0) registers its
+ *	name so data frames under it are received.
+ *
+ *	Arguments :
+ *	@type : 0 for an interest, 1 for data.
+ *	@rate : V-MAC frame rate, ignored.
+ *	@seq : Ignored, frames get the next 16-bit V-MAC seq of this process.
+ *	@buff : Frame.
+ *	@len : Length of the frame.
+ *	@interest_name : Interest name.
+ *	@name_len : Length of the interest name.
+ */
+void send_vmac(uint16_t type, uint16_t rate, uint16_t seq, char *buff, uint16_t len, char * interest_name, uint16_t name_len)
+{
+	struct loopHeader header = {.type = type, .nameLen = name_len, .len = len};
+	size_t size = sizeof(header)+name_len+len;
+	if(size > LOOP_FRAME_MAX || name_len >= sizeof(peers.names[0]))
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&channel.lock);
+	header.seq = peers.seq++;
+	if(type == 0)
+	{
+		int x = 0;
+		while(x < LOOP_MAX_NAMES-1 && peers.nameLen[x] != 0 && (peers.nameLen[x] != name_len || memcmp(peers.names[x],interest_name,name_len) != 0))
+		{
+			x++;
+		}
+		memcpy(peers.names[x],interest_name,name_len);
+		peers.nameLen[x] = name_len;
+	}
+	channel.sent++;
+
+	if(channel.toBad > 0 || channel.toGood > 0)
+	{
+		channel.bad = (channel.bad ? loopRandom() >= channel.toGood : loopRandom() < channel.toBad);
+	}
+	if(loopRandom() < (channel.bad ? channel.lossBad : channel.lossGood))
+	{
+		channel.lost++;
+		pthread_mutex_unlock(&channel.lock);
+		return;
+	}
+
+	long long now = loopNow();
+	long long departure = now;
+	if(channel.rate > 0)
+	{
+		while(channel.queueCount > 0 && channel.departures[channel.queueHead] <= now)
+		{
+			channel.queueHead = (channel.queueHead+1)%channel.queueMax;
+			channel.queueCount--;
+		}
+		if(channel.queueCount == channel.queueMax)
+		{
+			channel.queueDrops++;
+			pthread_mutex_unlock(&channel.lock);
+			return;
+		}
+		departure = (channel.linkFree > now ? channel.linkFree : now) + (long long)(len/channel.rate);
+		channel.linkFree = departure;
+		channel.departures[(channel.queueHead+channel.queueCount)%channel.queueMax] = departure;
+		channel.queueCount++;
+	}
+
+	struct loopFrame* frame = malloc(sizeof(struct loopFrame)+size);
+	if(frame == NULL)
+	{
+		pthread_mutex_unlock(&channel.lock);
+		printf("Error! Could not allocate loopback frame\n");
+		exit(-1);
+	}
+	frame->due = departure+channel.delay+(long long)(loopRandom()*channel.jitter);
+	if(channel.reorder > 0 && loopRandom() < channel.reorder)
+	{
+		frame->due += channel.reorderDelay;
+	}
+	frame->order = channel.order++;
+	frame->size = size;
+	memcpy(frame->data,&header,sizeof(header));
+	memcpy(&frame->data[sizeof(header)],interest_name,name_len);
+	memcpy(&frame->data[sizeof(header)+name_len],buff,len);
+	loopPush(frame);
+	pthread_cond_broadcast(&channel.changed);
+	pthread_mutex_unlock(&channel.lock);
+}
+
+/**
+ *  del_name  - Removes an interest name
+ *
+ *  Data frames under the name are no longer received.
+ */
+void del_name(char *interest_name, uint16_t name_len)
+{
+	pthread_mutex_lock(&channel.lock);
+	for(int x = 0;x<LOOP_MAX_NAMES;x++)
+	{
+		if(peers.nameLen[x] == name_len && memcmp(peers.names[x],interest_name,name_len) == 0)
+		{
+			peers.nameLen[x] = 0;
+		}
+	}
+	pthread_mutex_unlock(&channel.lock);
+}
+
+/**
+ *  setfixed_rate  - Fixed V-MAC frame rate
+ *
+ *  The loopback link's rate is set by VMAC_LOOP_RATE instead, so this does nothing.
+ */
+void setfixed_rate(uint8_t rate)
+{
+}
+
+/**
+ *  disable_frame_adaptation  - Turns off V-MAC frame rate adaptation
+ *
+ *  The loopback link has no rate adaptation, so this does nothing.
+ */
+void disable_frame_adaptation()
+{
+}
@@ -0,0 +1,447 @@
+//Payload codecs - shared by the sender and receiver, both copies must stay identical
+//Every codec compresses a buffer into one self-delimiting stream so several streams can be packed back to back in a frame
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zlib.h"
+#include "codec.h"
+
+#define LZ_MIN_MATCH 4 //Shortest match the LZ codec encodes
+#define LZ_MAX_OFFSET 65535 //Furthest back an LZ match can start
+#define LZ_HASH_BITS 12 //log2 of the number of entries in the LZ match finder
+
+//Compression contexts of each thread, set up on first use and reset for every stream after that
+__thread z_stream deflater;
+__thread int deflaterLevel = 0;//Level deflater was set up with, 0 until it is
+__thread z_stream inflater;
+__thread uint8_t inflaterReady = 0;
+__thread uint32_t lzTable[1<<LZ_HASH_BITS];//Position+1 of the last 4 bytes seen with each hash
+
+/**
+ *  profileCodec  - Codec for a compression profile
+ *
+ *	Arguments :
+ *	@profile : PROFILE_FASTEST, PROFILE_BALANCED or PROFILE_SMALLEST. Anything else is treated as PROFILE_SMALLEST.
+ */
+uint8_t profileCodec(int profile)
+{
+	switch(profile)
+	{
+		case PROFILE_FASTEST:
+			return CODEC_LZ;
+
+		case PROFILE_BALANCED:
+			return CODEC_ZLIB(6);
+
+		default:
+			return CODEC_ZLIB(9);
+	}
+}
+
+/**
+ *  codecName  - Printable codec name
+ *
+ *	Arguments :
+ *	@codec : Codec id.
+ */
+const char* codecName(uint8_t codec)
+{
+	static const char* names[CODEC_COUNT] = {"raw","lz","zlib-1","zlib-2","zlib-3","zlib-4","zlib-5","zlib-6","zlib-7","zlib-8","zlib-9"};
+	return (codec < CODEC_COUNT ? names[codec] : "unknown");
+}
+
+/**
+ *  codecBound  - Worst case stream size
+ *
+ *  Returns the largest stream codec can produce from inSize bytes.
+ *
+ *	Arguments :
+ *	@codec : Codec id.
+ *	@inSize : Size of the data to compress.
+ */
+uint32_t codecBound(uint8_t codec, uint32_t inSize)
+{
+	switch(codec)
+	{
+		case CODEC_RAW:
+			return inSize;
+
+		case CODEC_LZ:
+			return inSize + inSize/255 + 16;
+
+		default:
+			return compressBound(inSize);
+	}
+}
+
+/**
+ *  threadDeflater  - Per-thread compression context
+ *
+ *  Returns the calling thread's deflate stream at level ready for a new zlib stream. Only the first call on a thread
+ *	(or a change of level) allocates, so compressing a frame after that does no heap allocation.
+ *
+ *	Arguments :
+ *	@level : zlib compression level.
+ */
+z_stream* threadDeflater(int level)
+{
+	if(deflaterLevel == level)
+	{
+		deflateReset(&deflater);
+		return &deflater;
+	}
+
+	if(deflaterLevel != 0)
+	{
+		deflateEnd(&deflater);
+	}
+	memset(&deflater,0,sizeof(deflater));
+	int error = deflateInit(&deflater, level);
+	if(error != Z_OK)
+	{
+		printf("Compression Memory Error\n");
+		exit(error);
+	}
+	deflaterLevel = level;
+	return &deflater;
+}
+
+/**
+ *  threadInflater  - Per-thread decompression context
+ *
+ *  Returns the calling thread's inflate stream ready for a new zlib stream. Only the first call on a thread allocates,
+ *	and streams inflated whole with Z_FINISH never need the 32KB inflate window.
+ */
+z_stream* threadInflater()
+{
+	if(!inflaterReady)
+	{
+		memset(&inflater,0,sizeof(inflater));
+		int error = inflateInit(&inflater);
+		if(error != Z_OK)
+		{
+			printf("Compression Memory Error\n");
+			exit(error);
+		}
+		inflaterReady = 1;
+	}
+	else
+	{
+		inflateReset(&inflater);
+	}
+	return &inflater;
+}
+
+/**
+ *  releaseCodecs  - Frees the calling thread's codec contexts
+ */
+void releaseCodecs()
+{
+	if(deflaterLevel != 0)
+	{
+		deflateEnd(&deflater);
+		deflaterLevel = 0;
+	}
+	if(inflaterReady)
+	{
+		inflateEnd(&inflater);
+		inflaterReady = 0;
+	}
+}
+
+/**
+ *  lzLength  - Writes an LZ length extension
+ *
+ *  Lengths that do not fit in their 4-bit token field are continued in bytes of 255 ended by a byte below 255.
+ */
+uint8_t* lzLength(uint8_t* p, uint32_t length)
+{
+	if(length >= 15)
+	{
+		for(length -= 15;length >= 255;length -= 255)
+		{
+			*p++ = 255;
+		}
+		*p++ = length;
+	}
+	return p;
+}
+
+/**
+ *  lzSequence  - Writes one LZ sequence
+ *
+ *  A sequence is a token holding the literal count and match length - LZ_MIN_MATCH in its high and low 4 bits, the
+ *	literal count extension, the literals, the 16-bit little-endian match offset, then the match length extension.
+ *	The last sequence of a stream has literals only and an offset of 0.
+ *
+ *	Arguments :
+ *	@out : Stream buffer.
+ *	@outSize : Size of out.
+ *	@outLen : Bytes of out in use, advanced past the sequence.
+ *	@literals : Bytes copied before the match.
+ *	@literalCount : Number of literals.
+ *	@offset : Distance back to the start of the match, 0 for the last sequence.
+ *	@matchLength : Length of the match.
+ *
+ *	Returns 0 if the sequence does not fit in out.
+ */
+int lzSequence(uint8_t* out, uint32_t outSize, uint32_t* outLen, const uint8_t* literals, uint32_t literalCount, uint32_t offset, uint32_t matchLength)
+{
+	uint32_t matchCode = (offset != 0 ? matchLength-LZ_MIN_MATCH : 0);
+	if(outSize-*outLen < 1 + literalCount/255+1 + literalCount + 2 + matchCode/255+1)
+	{
+		return 0;
+	}
+
+	uint8_t* p = &out[*outLen];
+	*p++ = (literalCount < 15 ? literalCount : 15)<<4 | (matchCode < 15 ? matchCode : 15);
+	p = lzLength(p,literalCount);
+	memcpy(p,literals,literalCount);
+	p += literalCount;
+	*p++ = offset & 0xff;
+	*p++ = offset>>8;
+	if(offset != 0)
+	{
+		p = lzLength(p,matchCode);
+	}
+	*outLen = p - out;
+	return 1;
+}
+
+/**
+ *  lzCompress  - LZ stream compression
+ *
+ *  Greedy LZ77 with a single hash probe per position, skipping ahead faster the longer it goes without a match so
+ *	incompressible data costs little time.
+ */
+uint32_t lzCompress(const uint8_t* in, uint32_t inSize, uint8_t* out, uint32_t outSize)
+{
+	uint32_t pos = 0, anchor = 0, outLen = 0;
+	memset(lzTable,0,sizeof(lzTable));
+
+	while(inSize >= LZ_MIN_MATCH && pos <= inSize-LZ_MIN_MATCH)
+	{
+		uint32_t word;
+		memcpy(&word,&in[pos],sizeof(word));
+		uint32_t hash = (word*2654435761u)>>(32-LZ_HASH_BITS);
+		uint32_t match = lzTable[hash];
+		lzTable[hash] = pos+1;
+
+		if(match == 0 || pos-(match-1) > LZ_MAX_OFFSET || memcmp(&in[match-1],&in[pos],LZ_MIN_MATCH) != 0)
+		{
+			pos += 1 + ((pos-anchor)>>6);
+			continue;
+		}
+
+		match--;
+		uint32_t length = LZ_MIN_MATCH;
+		while(pos+length < inSize && in[match+length] == in[pos+length])
+		{
+			length++;
+		}
+		if(!lzSequence(out,outSize,&outLen,&in[anchor],pos-anchor,pos-match,length))
+		{
+			return 0;
+		}
+		pos += length;
+		anchor = pos;
+	}
+
+	if(!lzSequence(out,outSize,&outLen,&in[anchor],inSize-anchor,0,0))
+	{
+		return 0;
+	}
+	return outLen;
+}
+
+/**
+ *  lzReadLength  - Reads an LZ length extension
+ *
+ *  Returns 0 if the stream ends inside the extension.
+ */
+int lzReadLength(const uint8_t* in, uint32_t inSize, uint32_t* pos, uint32_t* length)
+{
+	if(*length == 15)
+	{
+		uint8_t byte;
+		do
+		{
+			if(*pos >= inSize)
+			{
+				return 0;
+			}
+			byte = in[(*pos)++];
+			*length += byte;
+		}while(byte == 255);
+	}
+	return 1;
+}
+
+/**
+ *  lzDecompress  - LZ stream decompression
+ */
+int lzDecompress(const uint8_t* in, uint32_t inSize, uint32_t* inUsed, uint8_t* out, uint32_t outSize, uint32_t* outUsed)
+{
+	uint32_t pos = 0, outLen = 0;
+	while(1)
+	{
+		if(pos >= inSize)
+		{
+			return Z_BUF_ERROR;
+		}
+		uint8_t token = in[pos++];
+		uint32_t literalCount = token>>4;
+		if(!lzReadLength(in,inSize,&pos,&literalCount) || inSize-pos < literalCount)
+		{
+			return Z_BUF_ERROR;
+		}
+		if(outSize-outLen < literalCount)
+		{
+			return Z_DATA_ERROR;
+		}
+		memcpy(&out[outLen],&in[pos],literalCount);
+		pos += literalCount;
+		outLen += literalCount;
+
+		if(inSize-pos < 2)
+		{
+			return Z_BUF_ERROR;
+		}
+		uint32_t offset = in[pos] | in[pos+1]<<8;
+		pos += 2;
+		if(offset == 0)
+		{
+			break;
+		}
+
+		uint32_t matchLength = token & 15;
+		if(!lzReadLength(in,inSize,&pos,&matchLength))
+		{
+			return Z_BUF_ERROR;
+		}
+		matchLength += LZ_MIN_MATCH;
+		if(offset > outLen || outSize-outLen < matchLength)
+		{
+			return Z_DATA_ERROR;
+		}
+		for(uint32_t x = 0;x<matchLength;x++)//Byte at a time since a match can overlap the bytes it produces
+		{
+			out[outLen+x] = out[outLen-offset+x];
+		}
+		outLen += matchLength;
+	}
+
+	*inUsed = pos;
+	*outUsed = outLen;
+	return Z_OK;
+}
+
+/**
+ *  codecCompress  - Single stream compression
+ *
+ *  Compresses in as one complete stream if the whole stream fits in outSize bytes.
+ *
+ *	Arguments :
+ *	@codec : Codec id.
+ *	@in : Data to compress.
+ *	@inSize : Size of in.
+ *	@out : Buffer for the stream.
+ *	@outSize : Size of out.
+ *
+ *	Returns the length of the stream, or 0 if it did not fit.
+ */
+uint32_t codecCompress(uint8_t codec, const uint8_t* in, uint32_t inSize, uint8_t* out, uint32_t outSize)
+{
+	if(codec == CODEC_RAW)
+	{
+		if(inSize > outSize)
+		{
+			return 0;
+		}
+		memcpy(out,in,inSize);
+		return inSize;
+	}
+	if(codec == CODEC_LZ)
+	{
+		return lzCompress(in,inSize,out,outSize);
+	}
+	if(codec >= CODEC_COUNT)
+	{
+		printf("Error! Unknown codec %u\n",codec);
+		exit(-1);
+	}
+
+	z_stream* strm = threadDeflater(codec-CODEC_ZLIB(0));
+	strm->next_in = (Bytef *)in;
+	strm->avail_in = inSize;
+	strm->next_out = out;
+	strm->avail_out = outSize;
+
+	int error = deflate(strm, Z_FINISH);
+	if(error == Z_STREAM_END)
+	{
+		return strm->total_out;
+	}
+	if(error != Z_OK && error != Z_BUF_ERROR)
+	{
+		printf("Compression Unknown error: %d\n",error);
+		exit(error);
+	}
+	return 0;
+}
+
+/**
+ *  codecDecompress  - Single stream decompression
+ *
+ *  Decompresses the stream at the start of in. A raw stream takes all of in.
+ *
+ *	Arguments :
+ *	@codec : Codec id.
+ *	@in : Compressed data, which may continue past the end of the stream.
+ *	@inSize : Size of in.
+ *	@inUsed : Set to the length of the stream.
+ *	@out : Buffer for the decompressed data.
+ *	@outSize : Size of out.
+ *	@outUsed : Set to the number of bytes decompressed.
+ *
+ *	Returns Z_OK, or a zlib error code if the stream is cut short, corrupt, or larger than out.
+ */
+int codecDecompress(uint8_t codec, const uint8_t* in, uint32_t inSize, uint32_t* inUsed, uint8_t* out, uint32_t outSize, uint32_t* outUsed)
+{
+	if(codec == CODEC_RAW)
+	{
+		if(inSize > outSize)
+		{
+			return Z_BUF_ERROR;
+		}
+		memcpy(out,in,inSize);
+		*inUsed = *outUsed = inSize;
+		return Z_OK;
+	}
+	if(codec == CODEC_LZ)
+	{
+		return lzDecompress(in,inSize,inUsed,out,outSize,outUsed);
+	}
+	if(codec >= CODEC_COUNT)
+	{
+		return Z_DATA_ERROR;
+	}
+
+	z_stream* strm = threadInflater();
+	strm->next_in = (Bytef *)in;
+	strm->avail_in = inSize;
+	strm->next_out = out;
+	strm->avail_out = outSize;
+
+	int error = inflate(strm, Z_FINISH);
+	if(error == Z_STREAM_END)
+	{
+		*inUsed = strm->total_in;
+		*outUsed = strm->total_out;
+		return Z_OK;
+	}
+	return (error == Z_OK ? Z_BUF_ERROR : error);
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#define CODEC_RAW 0 //Data sent as is
+#define CODEC_LZ 1 //In-tree byte-aligned LZ77, several times faster than zlib at a lower ratio
+#define CODEC_ZLIB(level) (1+(level)) //zlib stream at compression level 1-9
+#define CODEC_COUNT 11
+#define FRAME_DATA_MAX (1024*1024) //Most bytes the streams in one frame may decompress to
+#define MOOV_SEGMENT (64*1024) //Bytes of moov compressed as one independently decodable segment
+
+#define PROFILE_FASTEST 0 //LZ, for senders where compression time outweighs airtime
+#define PROFILE_BALANCED 1 //zlib level 6
+#define PROFILE_SMALLEST 2 //zlib level 9
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stdint.h>
+
+uint8_t profileCodec(int profile);
+
+const char* codecName(uint8_t codec);
+
+uint32_t codecBound(uint8_t codec, uint32_t inSize);
+
+uint32_t codecCompress(uint8_t codec, const uint8_t* in, uint32_t inSize, uint8_t* out, uint32_t outSize);
+
+int codecDecompress(uint8_t codec, const uint8_t* in, uint32_t inSize, uint32_t* inUsed, uint8_t* out, uint32_t outSize, uint32_t* outUsed);
+
+void releaseCodecs();
+
+#endif
\ No newline at end of file
@@ -0,0 +1,740 @@
+//Reed-Solomon erasure code - shared by the sender and receiver, both copies must stay identical
+//Blocks of up to FEC_MAX_DATA data symbols are protected by up to FEC_MAX_PARITY parity symbols. Parity symbol j is the sum over
+//the data symbols i of fecCoefficient(j,i)*symbol i in GF(256), a Cauchy matrix, so any data symbols lost from a block can be
+//rebuilt from the same number of parity symbols whichever ones arrive
+//Fountain code - blocks of up to FOUNTAIN_BLOCK data symbols are sent as an open-ended run of LT symbols, each the XOR of a
+//random set of data symbols with a robust soliton number of members. A block decodes from slightly more symbols than it has
+//data symbols, whichever ones arrive
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define GF_SSSE3
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define GF_NEON
+#endif
+
+#include "fec.h"
+
+#define GF_POLY 0x11d //x^8+x^4+x^3+x^2+1, the field polynomial
+
+uint8_t gfExp[512];//Powers of the generator, doubled so the sum of two logs needs no reduction
+uint8_t gfLog[256];
+uint8_t gfTables[256][32];//Products of each coefficient with every low nibble then every high nibble, for the table lookup kernels
+void (*gfKernel)(uint8_t* dst, const uint8_t* src, uint8_t c, uint32_t len);
+const char* gfKernelLabel;
+pthread_once_t gfOnce = PTHREAD_ONCE_INIT;
+
+/**
+ *  gfMul  - GF(256) multiply
+ *
+ *	Arguments :
+ *	@a : First factor.
+ *	@b : Second factor.
+ */
+uint8_t gfMul(uint8_t a, uint8_t b)
+{
+	return (a == 0 || b == 0 ? 0 : gfExp[gfLog[a]+gfLog[b]]);
+}
+
+/**
+ *  gfInv  - GF(256) inverse
+ *
+ *	Arguments :
+ *	@a : Non-zero element.
+ */
+uint8_t gfInv(uint8_t a)
+{
+	return gfExp[255-gfLog[a]];
+}
+
+/**
+ *  gfMulAddScalar  - Portable multiply-add kernel
+ *
+ *  Looks up the two nibbles of each byte in the coefficient's product tables.
+ */
+void gfMulAddScalar(uint8_t* dst, const uint8_t* src, uint8_t c, uint32_t len)
+{
+	const uint8_t* table = gfTables[c];
+	for(uint32_t x = 0;x<len;x++)
+	{
+		dst[x] ^= table[src[x] & 0x0f] ^ table[16 + (src[x] >> 4)];
+	}
+}
+
+#ifdef GF_SSSE3
+/**
+ *  gfMulAddSsse3  - SSSE3 multiply-add kernel
+ *
+ *  Looks up 16 low and high nibbles at a time with pshufb. Built for SSSE3 whatever the compiler flags and only chosen when
+ *	the CPU has it.
+ */
+__attribute__((target("ssse3"))) void gfMulAddSsse3(uint8_t* dst, const uint8_t* src, uint8_t c, uint32_t len)
+{
+	const __m128i low = _mm_loadu_si128((const __m128i*)gfTables[c]);
+	const __m128i high = _mm_loadu_si128((const __m128i*)&gfTables[c][16]);
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	uint32_t x = 0;
+	for(;x+16<=len;x += 16)
+	{
+		__m128i in = _mm_loadu_si128((const __m128i*)&src[x]);
+		__m128i product = _mm_xor_si128(_mm_shuffle_epi8(low,_mm_and_si128(in,mask)),_mm_shuffle_epi8(high,_mm_and_si128(_mm_srli_epi64(in,4),mask)));
+		_mm_storeu_si128((__m128i*)&dst[x],_mm_xor_si128(_mm_loadu_si128((const __m128i*)&dst[x]),product));
+	}
+	gfMulAddScalar(&dst[x],&src[x],c,len-x);
+}
+#endif
+
+#ifdef GF_NEON
+/**
+ *  gfMulAddNeon  - NEON multiply-add kernel
+ *
+ *  Looks up 16 low and high nibbles at a time with tbl, as two 8 byte lookups on 32-bit ARM.
+ */
+void gfMulAddNeon(uint8_t* dst, const uint8_t* src, uint8_t c, uint32_t len)
+{
+	const uint8x16_t mask = vdupq_n_u8(0x0f);
+#ifdef __aarch64__
+	const uint8x16_t low = vld1q_u8(gfTables[c]);
+	const uint8x16_t high = vld1q_u8(&gfTables[c][16]);
+#else
+	const uint8x8x2_t low = {{vld1_u8(gfTables[c]),vld1_u8(&gfTables[c][8])}};
+	const uint8x8x2_t high = {{vld1_u8(&gfTables[c][16]),vld1_u8(&gfTables[c][24])}};
+#endif
+	uint32_t x = 0;
+	for(;x+16<=len;x += 16)
+	{
+		uint8x16_t in = vld1q_u8(&src[x]);
+		uint8x16_t lowNibbles = vandq_u8(in,mask);
+		uint8x16_t highNibbles = vshrq_n_u8(in,4);
+#ifdef __aarch64__
+		uint8x16_t product = veorq_u8(vqtbl1q_u8(low,lowNibbles),vqtbl1q_u8(high,highNibbles));
+#else
+		uint8x16_t product = vcombine_u8(veor_u8(vtbl2_u8(low,vget_low_u8(lowNibbles)),vtbl2_u8(high,vget_low_u8(highNibbles))),
+			veor_u8(vtbl2_u8(low,vget_high_u8(lowNibbles)),vtbl2_u8(high,vget_high_u8(highNibbles))));
+#endif
+		vst1q_u8(&dst[x],veorq_u8(vld1q_u8(&dst[x]),product));
+	}
+	gfMulAddScalar(&dst[x],&src[x],c,len-x);
+}
+#endif
+
+/**
+ *  gfInit  - Builds the field tables and picks the multiply-add kernel
+ */
+void gfInit()
+{
+	unsigned value = 1;
+	for(int x = 0;x<255;x++)
+	{
+		gfExp[x] = value;
+		gfExp[x+255] = value;
+		gfLog[value] = x;
+		value <<= 1;
+		if(value & 0x100)
+		{
+			value ^= GF_POLY;
+		}
+	}
+	gfExp[510] = gfExp[0];
+	gfExp[511] = gfExp[1];
+	for(int c = 0;c<256;c++)
+	{
+		for(int x = 0;x<16;x++)
+		{
+			gfTables[c][x] = gfMul(c,x);
+			gfTables[c][16+x] = gfMul(c,x<<4);
+		}
+	}
+	
+	gfKernel = gfMulAddScalar;
+	gfKernelLabel = "scalar";
+#ifdef GF_SSSE3
+	if(__builtin_cpu_supports("ssse3"))
+	{
+		gfKernel = gfMulAddSsse3;
+		gfKernelLabel = "ssse3";
+	}
+#endif
+#ifdef GF_NEON
+	gfKernel = gfMulAddNeon;
+	gfKernelLabel = "neon";
+#endif
+}
+
+/**
+ *  fecCoefficient  - Erasure code matrix entry
+ *
+ *  Returns the weight of a data symbol in a parity symbol, 1/(x+y) with x = parity in [0,128) and y = data+128 in [128,256).
+ *	Every square part of this Cauchy matrix can be inverted, which is what lets any parity symbols stand in for lost data.
+ *	
+ *	Arguments :
+ *	@parity : Parity index, below FEC_MAX_PARITY.
+ *	@data : Position of the data symbol in its block, below FEC_MAX_DATA.
+ */
+uint8_t fecCoefficient(uint8_t parity, uint8_t data)
+{
+	pthread_once(&gfOnce,gfInit);
+	return gfInv(parity ^ (FEC_MAX_DATA+data));
+}
+
+/**
+ *  gfMulAdd  - GF(256) multiply-add over a buffer
+ *
+ *  dst[x] += c*src[x] for every byte, with the fastest kernel the CPU supports.
+ *	
+ *	Arguments :
+ *	@dst : Buffer added to.
+ *	@src : Buffer multiplied.
+ *	@c : Coefficient.
+ *	@len : Length of both buffers.
+ */
+void gfMulAdd(uint8_t* dst, const uint8_t* src, uint8_t c, uint32_t len)
+{
+	pthread_once(&gfOnce,gfInit);
+	if(c != 0)
+	{
+		gfKernel(dst,src,c,len);
+	}
+}
+
+/**
+ *  gfKernelName  - Printable name of the multiply-add kernel in use
+ */
+const char* gfKernelName()
+{
+	pthread_once(&gfOnce,gfInit);
+	return gfKernelLabel;
+}
+
+/**
+ *  fecRecover  - Rebuilds lost data symbols of a block
+ *
+ *  Removes the received data symbols from as many parity symbols as there are lost ones, then solves the square Cauchy
+ *	system left for the lost symbols. The parity buffers are used as scratch space.
+ *	
+ *	Arguments :
+ *	@data : Data symbols of the block, lost ones are written in place.
+ *	@have : 1 for each data symbol received.
+ *	@dataCount : Number of data symbols in the block.
+ *	@parity : Received parity symbols.
+ *	@parityIndex : Parity index of each received parity symbol.
+ *	@parityCount : Number of received parity symbols.
+ *	@symbolSize : Length of every symbol, with data symbols zero padded to the parity length.
+ *
+ *	Returns 1 if every lost symbol was rebuilt, or 0 if too few parity symbols were received.
+ */
+int fecRecover(uint8_t** data, const uint8_t* have, uint8_t dataCount, uint8_t** parity, const uint8_t* parityIndex, uint8_t parityCount, uint32_t symbolSize)
+{
+	uint8_t lost[FEC_MAX_DATA];
+	int lostCount = 0;
+	for(int x = 0;x<dataCount;x++)
+	{
+		if(!have[x])
+		{
+			lost[lostCount++] = x;
+		}
+	}
+	if(lostCount == 0)
+	{
+		return 1;
+	}
+	if(parityCount < lostCount)
+	{
+		return 0;
+	}
+	
+	//Matrix of the lost symbols' weights in the parity symbols used, inverted alongside the identity by Gauss-Jordan elimination
+	uint8_t* matrix = malloc(2*lostCount*lostCount);
+	if(matrix == NULL)
+	{
+		printf("Error! Could not allocate erasure decoder\n");
+		exit(-1);
+	}
+	uint8_t* inverse = &matrix[lostCount*lostCount];
+	memset(inverse,0,lostCount*lostCount);
+	for(int row = 0;row<lostCount;row++)
+	{
+		for(int x = 0;x<dataCount;x++)
+		{
+			if(have[x])
+			{
+				gfMulAdd(parity[row],data[x],fecCoefficient(parityIndex[row],x),symbolSize);
+			}
+		}
+		for(int col = 0;col<lostCount;col++)
+		{
+			matrix[row*lostCount+col] = fecCoefficient(parityIndex[row],lost[col]);
+		}
+		inverse[row*lostCount+row] = 1;
+	}
+	
+	for(int col = 0;col<lostCount;col++)
+	{
+		int pivot = col;
+		while(pivot < lostCount && matrix[pivot*lostCount+col] == 0)
+		{
+			pivot++;
+		}
+		if(pivot == lostCount)//Only if two received parity symbols share an index
+		{
+			free(matrix);
+			return 0;
+		}
+		for(int x = 0;x<lostCount && pivot != col;x++)
+		{
+			uint8_t temp = matrix[col*lostCount+x];
+			matrix[col*lostCount+x] = matrix[pivot*lostCount+x];
+			matrix[pivot*lostCount+x] = temp;
+			temp = inverse[col*lostCount+x];
+			inverse[col*lostCount+x] = inverse[pivot*lostCount+x];
+			inverse[pivot*lostCount+x] = temp;
+		}
+		
+		uint8_t scale = gfInv(matrix[col*lostCount+col]);
+		for(int x = 0;x<lostCount;x++)
+		{
+			matrix[col*lostCount+x] = gfMul(matrix[col*lostCount+x],scale);
+			inverse[col*lostCount+x] = gfMul(inverse[col*lostCount+x],scale);
+		}
+		for(int row = 0;row<lostCount;row++)
+		{
+			uint8_t factor = matrix[row*lostCount+col];
+			if(row != col && factor != 0)
+			{
+				gfMulAdd(&matrix[row*lostCount],&matrix[col*lostCount],factor,lostCount);
+				gfMulAdd(&inverse[row*lostCount],&inverse[col*lostCount],factor,lostCount);
+			}
+		}
+	}
+	
+	for(int x = 0;x<lostCount;x++)
+	{
+		memset(data[lost[x]],0,symbolSize);
+		for(int row = 0;row<lostCount;row++)
+		{
+			gfMulAdd(data[lost[x]],parity[row],inverse[x*lostCount+row],symbolSize);
+		}
+	}
+	free(matrix);
+	return 1;
+}
+
+/**
+ *  fountainLog  - Natural log in 16.16 fixed point
+ *
+ *  Integer only, so the sender and receiver build the same degree distribution whatever their floating point library.
+ *	
+ *	Arguments :
+ *	@x : Value in 16.16 fixed point, at least 1.0.
+ */
+uint64_t fountainLog(uint64_t x)
+{
+	uint64_t log2 = 0;//log2 of x in 16.16, from the position of the top bit and a linear fit of the rest
+	while(x >= (2ull<<16))
+	{
+		x >>= 1;
+		log2 += 1<<16;
+	}
+	log2 += x-(1<<16);
+	return (log2*45426)>>16;//ln 2 in 16.16
+}
+
+/**
+ *  fountainDegrees  - Robust soliton distribution for a block
+ *
+ *  Fills cdf with the chance, out of 2^24, of a fountain symbol having each degree up to the given one, using the ideal soliton
+ *	distribution with a spike at dataCount/R, R = FOUNTAIN_C*ln(dataCount/FOUNTAIN_DELTA)*sqrt(dataCount). The last distribution
+ *	built is kept, as every block but the last has the same number of data symbols.
+ *	
+ *	Arguments :
+ *	@dataCount : Data symbols in the block.
+ */
+const uint32_t* fountainDegrees(uint16_t dataCount)
+{
+	static __thread uint32_t cdf[FOUNTAIN_BLOCK+1];
+	static __thread uint16_t cdfCount = 0;
+	if(cdfCount == dataCount)
+	{
+		return cdf;
+	}
+	
+	uint64_t root = 0;
+	while((root+1)*(root+1) <= dataCount)
+	{
+		root++;
+	}
+	uint64_t r = FOUNTAIN_C*fountainLog(((uint64_t)dataCount<<16)*FOUNTAIN_DELTA_INV)*root/100;//R in 16.16
+	if(r < (1<<16))
+	{
+		r = 1<<16;
+	}
+	uint64_t spike = ((uint64_t)dataCount<<16)/r;
+	if(spike < 1)
+	{
+		spike = 1;
+	}
+	if(spike > dataCount)
+	{
+		spike = dataCount;
+	}
+	
+	uint64_t weight[FOUNTAIN_BLOCK+1];//Weight of each degree out of 2^32 before normalising
+	uint64_t total = 0;
+	for(uint64_t d = 1;d<=dataCount;d++)
+	{
+		weight[d] = (d == 1 ? (1ull<<32)/dataCount : (1ull<<32)/(d*(d-1)));
+		if(d < spike)
+		{
+			weight[d] += ((r<<16)/(d*dataCount));
+		}
+		else if(d == spike)
+		{
+			uint64_t ratio = r*FOUNTAIN_DELTA_INV;
+			weight[d] += ((r*(ratio > (1<<16) ? fountainLog(ratio) : 0))/dataCount);
+		}
+		total += weight[d];
+	}
+	uint64_t sum = 0;
+	cdf[0] = 0;
+	for(uint64_t d = 1;d<=dataCount;d++)
+	{
+		sum += weight[d];
+		cdf[d] = (sum<<24)/total;
+	}
+	cdf[dataCount] = 1<<24;
+	cdfCount = dataCount;
+	return cdf;
+}
+
+/**
+ *  fountainNeighbours  - Data symbols making up a fountain symbol
+ *
+ *  Draws the degree of the symbol from fountainDegrees and that many distinct data symbols, from a generator seeded by the block
+ *	and symbol ID so the receiver draws the same ones.
+ *	
+ *	Arguments :
+ *	@block : Block of the symbol.
+ *	@symbol : ID of the symbol in its block.
+ *	@dataCount : Data symbols in the block.
+ *	@neighbours : Set to the data symbols, dataCount entries are enough.
+ *
+ *	Returns the degree of the symbol.
+ */
+uint16_t fountainNeighbours(uint32_t block, uint32_t symbol, uint16_t dataCount, uint16_t* neighbours)
+{
+	uint64_t state = ((uint64_t)block<<32 | symbol) + 0x9E3779B97F4A7C15ull;
+	#define FOUNTAIN_RANDOM() (state ^= state<<13, state ^= state>>7, state ^= state<<17, (uint32_t)(state>>16))
+	for(int x = 0;x<4;x++)
+	{
+		FOUNTAIN_RANDOM();
+	}
+	
+	const uint32_t* cdf = fountainDegrees(dataCount);
+	uint32_t pick = FOUNTAIN_RANDOM() & ((1<<24)-1);
+	uint16_t low = 1, high = dataCount;
+	while(low < high)
+	{
+		uint16_t mid = (low+high)/2;
+		if(cdf[mid] > pick)
+		{
+			high = mid;
+		}
+		else
+		{
+			low = mid+1;
+		}
+	}
+	uint16_t degree = low;
+	
+	uint64_t picked[FOUNTAIN_BLOCK/64] = {0};
+	for(uint16_t x = 0;x<degree;x++)
+	{
+		uint16_t candidate;
+		do
+		{
+			candidate = FOUNTAIN_RANDOM()%dataCount;
+		}while(picked[candidate/64] & (1ull<<(candidate%64)));
+		picked[candidate/64] |= 1ull<<(candidate%64);
+		neighbours[x] = candidate;
+	}
+	#undef FOUNTAIN_RANDOM
+	return degree;
+}
+
+/**
+ *  fountainDecode  - Rebuilds the data symbols of a fountain coded block
+ *
+ *  Peels the received symbols first: a symbol with one data symbol left unknown gives that data symbol, which is then removed
+ *	from every other symbol holding it. When no such symbol is left, the data symbols still unknown are solved for by Gaussian
+ *	elimination over GF(2) on the symbols left. The symbol buffers are used as scratch space.
+ *	
+ *	Arguments :
+ *	@data : Data symbols of the block, rebuilt ones are written in place.
+ *	@have : 1 for each data symbol already known, set for each one rebuilt.
+ *	@dataCount : Number of data symbols in the block.
+ *	@symbols : Received fountain symbols.
+ *	@symbolId : ID of each received fountain symbol.
+ *	@symbolCount : Number of received fountain symbols.
+ *	@block : Block of the symbols.
+ *	@symbolSize : Length of every symbol.
+ *
+ *	Returns the number of data symbols that could not be rebuilt.
+ */
+uint32_t fountainDecode(uint8_t** data, uint8_t* have, uint16_t dataCount, uint8_t** symbols, const uint32_t* symbolId, uint32_t symbolCount, uint32_t block, uint32_t symbolSize)
+{
+	uint32_t missing = 0;
+	for(uint16_t x = 0;x<dataCount;x++)
+	{
+		missing += !have[x];
+	}
+	if(missing == 0 || symbolCount == 0)
+	{
+		return missing;
+	}
+	
+	//Graph of the symbols, with each symbol's data symbols and each data symbol's symbols as ranges of one array
+	uint32_t* first = malloc((symbolCount+1)*sizeof(uint32_t));
+	uint16_t* unknown = malloc(symbolCount*sizeof(uint16_t));//Data symbols of each symbol not known yet
+	uint32_t* dataFirst = calloc(dataCount+1,sizeof(uint32_t));
+	uint32_t edgeSpace = symbolCount*16;
+	uint16_t* edges = malloc(edgeSpace*sizeof(uint16_t));
+	if(first == NULL || unknown == NULL || dataFirst == NULL || edges == NULL)
+	{
+		printf("Error! Could not allocate fountain decoder\n");
+		exit(-1);
+	}
+	uint32_t edgeCount = 0;
+	for(uint32_t x = 0;x<symbolCount;x++)
+	{
+		if(edgeCount+dataCount > edgeSpace)
+		{
+			edgeSpace = 2*edgeSpace+dataCount;
+			edges = realloc(edges,edgeSpace*sizeof(uint16_t));
+			if(edges == NULL)
+			{
+				printf("Error! Could not allocate fountain decoder\n");
+				exit(-1);
+			}
+		}
+		first[x] = edgeCount;
+		uint16_t degree = fountainNeighbours(block,symbolId[x],dataCount,&edges[edgeCount]);
+		unknown[x] = 0;
+		for(uint16_t y = 0;y<degree;y++)
+		{
+			uint16_t d = edges[edgeCount+y];
+			if(have[d])
+			{
+				gfMulAdd(symbols[x],data[d],1,symbolSize);
+			}
+			else
+			{
+				edges[edgeCount+unknown[x]++] = d;
+				dataFirst[d+1]++;
+			}
+		}
+		edgeCount += unknown[x];
+	}
+	first[symbolCount] = edgeCount;
+	for(uint16_t x = 0;x<dataCount;x++)
+	{
+		dataFirst[x+1] += dataFirst[x];
+	}
+	uint32_t* dataEdges = malloc((edgeCount+1)*sizeof(uint32_t));
+	uint32_t* fill = malloc((dataCount+1)*sizeof(uint32_t));
+	uint32_t* queue = malloc(symbolCount*sizeof(uint32_t));
+	if(dataEdges == NULL || fill == NULL || queue == NULL)
+	{
+		printf("Error! Could not allocate fountain decoder\n");
+		exit(-1);
+	}
+	memcpy(fill,dataFirst,dataCount*sizeof(uint32_t));
+	uint32_t queued = 0;
+	for(uint32_t x = 0;x<symbolCount;x++)
+	{
+		for(uint32_t y = first[x];y<first[x+1];y++)
+		{
+			dataEdges[fill[edges[y]]++] = x;
+		}
+		if(unknown[x] == 1)
+		{
+			queue[queued++] = x;
+		}
+	}
+	
+	for(uint32_t next = 0;next<queued;next++)
+	{
+		uint32_t s = queue[next];
+		if(unknown[s] != 1)
+		{
+			continue;
+		}
+		uint16_t d = 0;
+		for(uint32_t y = first[s];y<first[s+1];y++)
+		{
+			if(!have[edges[y]])
+			{
+				d = edges[y];
+				break;
+			}
+		}
+		memcpy(data[d],symbols[s],symbolSize);
+		have[d] = 1;
+		missing--;
+		unknown[s] = 0;
+		for(uint32_t y = dataFirst[d];y<dataFirst[d+1];y++)
+		{
+			uint32_t t = dataEdges[y];
+			if(unknown[t] != 0)
+			{
+				gfMulAdd(symbols[t],data[d],1,symbolSize);
+				if(--unknown[t] == 1)
+				{
+					queue[queued++] = t;
+				}
+			}
+		}
+	}
+	
+	if(missing != 0)
+	{
+		//Peeling stalled, each symbol left becomes a row of bits over the data symbols still unknown
+		uint16_t* column = malloc(dataCount*sizeof(uint16_t));
+		uint16_t* columnData = malloc(missing*sizeof(uint16_t));
+		uint32_t words = (missing+63)/64;
+		uint32_t rowCount = 0;
+		for(uint32_t x = 0;x<symbolCount;x++)
+		{
+			rowCount += (unknown[x] != 0);
+		}
+		uint64_t* bits = calloc((uint64_t)rowCount*words+1,sizeof(uint64_t));
+		uint32_t* rowSymbol = malloc((rowCount+1)*sizeof(uint32_t));
+		if(column == NULL || columnData == NULL || bits == NULL || rowSymbol == NULL)
+		{
+			printf("Error! Could not allocate fountain decoder\n");
+			exit(-1);
+		}
+		uint32_t col = 0;
+		for(uint16_t x = 0;x<dataCount;x++)
+		{
+			if(!have[x])
+			{
+				columnData[col] = x;
+				column[x] = col++;
+			}
+		}
+		uint32_t row = 0;
+		for(uint32_t x = 0;x<symbolCount;x++)
+		{
+			if(unknown[x] != 0)
+			{
+				for(uint32_t y = first[x];y<first[x+1];y++)
+				{
+					if(!have[edges[y]])
+					{
+						bits[row*words+column[edges[y]]/64] |= 1ull<<(column[edges[y]]%64);
+					}
+				}
+				rowSymbol[row++] = x;
+			}
+		}
+		
+		//Gauss-Jordan elimination, pivot rows are moved to the top in column order
+		uint32_t* pivotRow = malloc(missing*sizeof(uint32_t));
+		if(pivotRow == NULL)
+		{
+			printf("Error! Could not allocate fountain decoder\n");
+			exit(-1);
+		}
+		uint32_t rank = 0;
+		for(col = 0;col<missing;col++)
+		{
+			pivotRow[col] = UINT32_MAX;
+			uint32_t word = col/64;
+			uint64_t bit = 1ull<<(col%64);
+			uint32_t pivot = rank;
+			while(pivot < rowCount && !(bits[pivot*words+word] & bit))
+			{
+				pivot++;
+			}
+			if(pivot == rowCount)
+			{
+				continue;
+			}
+			if(pivot != rank)
+			{
+				for(uint32_t w = 0;w<words;w++)
+				{
+					uint64_t temp = bits[rank*words+w];
+					bits[rank*words+w] = bits[pivot*words+w];
+					bits[pivot*words+w] = temp;
+				}
+				uint32_t temp = rowSymbol[rank];
+				rowSymbol[rank] = rowSymbol[pivot];
+				rowSymbol[pivot] = temp;
+			}
+			for(row = 0;row<rowCount;row++)
+			{
+				if(row != rank && (bits[row*words+word] & bit))
+				{
+					for(uint32_t w = 0;w<words;w++)//Earlier words can still hold columns that had no pivot
+					{
+						bits[row*words+w] ^= bits[rank*words+w];
+					}
+					gfMulAdd(symbols[rowSymbol[row]],symbols[rowSymbol[rank]],1,symbolSize);
+				}
+			}
+			pivotRow[col] = rank++;
+		}
+		
+		//A pivot row with no other unknown left holds its data symbol
+		for(col = 0;col<missing;col++)
+		{
+			if(pivotRow[col] == UINT32_MAX)
+			{
+				continue;
+			}
+			uint32_t r = pivotRow[col];
+			int alone = 1;
+			for(uint32_t w = 0;w<words && alone;w++)
+			{
+				uint64_t rest = bits[r*words+w];
+				if(w == col/64)
+				{
+					rest &= ~(1ull<<(col%64));
+				}
+				alone = (rest == 0);
+			}
+			if(alone)
+			{
+				memcpy(data[columnData[col]],symbols[rowSymbol[r]],symbolSize);
+				have[columnData[col]] = 1;
+			}
+		}
+		missing = 0;
+		for(uint16_t x = 0;x<dataCount;x++)
+		{
+			missing += !have[x];
+		}
+		free(pivotRow);
+		free(column);
+		free(columnData);
+		free(bits);
+		free(rowSymbol);
+	}
+	
+	free(first);
+	free(unknown);
+	free(dataFirst);
+	free(edges);
+	free(dataEdges);
+	free(fill);
+	free(queue);
+	return missing;
+}
@@ -12,6 +12,8 @@
 #include <string.h>
 #include <time.h>
 #include "sendFunctions5.h"
+#include "codec.h"
+#include "fec.h"
 
 //#define FILE_NAME "RPi_Logo.png"
 //#define INTEREST_NAME "Raspberry"
@@ -75,6 +77,44 @@ int main()
 		setfixed_rate(rate);
 	}
 	
+	int profile = PROFILE_SMALLEST;
+	printf("Choose compression profile(%d = fastest, %d = balanced, %d = smallest): ",PROFILE_FASTEST,PROFILE_BALANCED,PROFILE_SMALLEST);
+	scanf("%d",&profile);
+	setCompressionProfile(profile);
+	
+	int fecData = 0, fecParity = 0;
+	printf("Choose erasure coding data and parity frames per block(0 0 = none, up to %d %d): ",FEC_MAX_DATA,FEC_MAX_PARITY);
+	scanf("%d %d",&fecData,&fecParity);
+	setFec(fecData,fecParity);
+	
+	int kbps = 0, burst = 0;
+	printf("Choose pacing rate in kbit/s and burst in frames(0 0 = unpaced): ");
+	scanf("%d %d",&kbps,&burst);
+	setPacing(kbps,burst);
+	
+	if(strcmp(getExt(fileName),"png") != 0)
+	{
+		int overhead = 0;
+		printf("Choose fountain coding symbols for loss in percent of the data(0 = no fountain coding, up to %d): ",FOUNTAIN_OVERHEAD_MAX);
+		scanf("%d",&overhead);
+		setFountain(overhead);
+	}
+	
+	if(strcmp(getExt(fileName),"png") == 0)
+	{
+		int progressive = 0;
+		printf("Send PNG progressively, coarse to fine(0 = no, 1 = yes): ");
+		scanf("%d",&progressive);
+		setPngProgressive(progressive);
+	}
+	else if(strcmp(getExt(fileName),"mov") == 0 || strcmp(getExt(fileName),"mp4") == 0)
+	{
+		int copies = 1;
+		printf("Choose extra copies of keyframe data(0-%d): ",KEYFRAME_COPIES_MAX);
+		scanf("%d",&copies);
+		setKeyframeCopies(copies);
+	}
+	
 	unsigned int timeout = 0;
 	printf("Enter interest timeout(seconds): ");
 	scanf("%u",&timeout);
@@ -121,6 +161,7 @@ int main()
 	send_vmac(1,0,0,done,len,intname,name_len);
 	*/
 	printf("Sent\n");
+	sendReport();
 	
 	return 0;
 }
\ No newline at end of file
@@ -753,6 +753,14 @@ typedef struct LodePNGState {
 void lodepng_state_init(LodePNGState* state);
 void lodepng_state_cleanup(LodePNGState* state);
 void lodepng_state_copy(LodePNGState* dest, const LodePNGState* source);
+
+/*
+Outputs the width and height in pixels of the 7 Adam7 passes of a w*h image with bpp
+bits per pixel, and in passstart the offset of each pass in the interlaced pixel data
+with the 8th value the size of all of it. Passes of images with at least 8 bits per
+pixel are packed back to back.
+*/
+void lodepng_adam7_passes(unsigned passw[7], unsigned passh[7], size_t passstart[8], unsigned w, unsigned h, unsigned bpp);
 #endif /* defined(LODEPNG_COMPILE_DECODER) || defined(LODEPNG_COMPILE_ENCODER) */
 
 #ifdef LODEPNG_COMPILE_DECODER
@@ -772,6 +780,21 @@ information is placed in the info_png field of the LodePNGState.
 unsigned lodepng_inspect(unsigned* w, unsigned* h,
                          LodePNGState* state,
                          const unsigned char* in, size_t insize);
+
+/*
+Undoes PNG filter method 0 on one scanline of length bytes. precon is the previous
+unfiltered scanline, or NULL for the first one. recon and scanline may be the same
+memory, precon must be disjoint. bytewidth is the number of bytes per pixel, or 1
+when pixels are smaller than a byte. Returns error 36 for an unknown filterType.
+*/
+unsigned lodepng_unfilter_scanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                   size_t bytewidth, unsigned char filterType, size_t length);
+
+/*
+Reorders the Adam7 interlaced pixel data in, laid out as lodepng_adam7_passes
+describes, into the w*h image out. If bpp is less than 8, out must be zeroed.
+*/
+void lodepng_adam7_deinterlace(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp);
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 /*
@@ -794,6 +817,19 @@ unsigned lodepng_inspect_chunk(LodePNGState* state, size_t pos,
 unsigned lodepng_encode(unsigned char** out, size_t* outsize,
                         const unsigned char* image, unsigned w, unsigned h,
                         LodePNGState* state);
+
+/*
+Applies PNG filter method 0 filterType (0-4) to one scanline of length bytes.
+prevline is the previous unfiltered scanline, or NULL for the first one.
+*/
+void lodepng_filter_scanline(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                             size_t length, size_t bytewidth, unsigned char filterType);
+
+/*
+Reorders the pixels of the w*h image in into Adam7 interlaced order in out, laid
+out as lodepng_adam7_passes describes. If bpp is less than 8, out must be zeroed.
+*/
+void lodepng_adam7_interlace(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp);
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
 /*
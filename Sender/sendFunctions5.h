@@ -1,8 +1,42 @@
 #define BUFFER_SIZE 1024
+#define FRAME_HEADER_SIZE 7 //Every frame starts with a 3 character file type followed by the 32-bit frame sequence stamped by sendFrame
+
+#define SEND_BATCH 64 //Most frames the send paths hand to sendFrames in one call
+#define KEYFRAME_COPIES_MAX 4 //Most extra copies setKeyframeCopies allows of mdat frames holding keyframe samples
+#define FOUNTAIN_OVERHEAD_MAX 1000 //Most fountain symbols for loss setFountain allows, in percent of the data frames
 
 #ifndef SEND_FUNCTIONS_H
 #define SEND_FUNCTIONS_H
 
+#include <stdint.h>
+#include <sys/uio.h>
+
+//Frame given to sendFrames as a header and a payload that can be anywhere, such as a mapped input file
+struct frameParts
+{
+	struct iovec header;//Starts with FRAME_HEADER_SIZE bytes for the file type and frame sequence
+	const void* payload;
+	uint16_t payloadLen;
+};
+
+void sendFrames(struct frameParts* frames,int count,int rate,char *intname,uint16_t name_len);
+
+void sendFrame(char *data,uint16_t len,int rate,char *intname,uint16_t name_len);
+
+void setCompressionProfile(int profile);
+
+void setPngProgressive(int progressive);
+
+void setKeyframeCopies(int copies);
+
+void setFec(int data,int parityCount);
+
+void setFountain(int overhead);
+
+void setPacing(int kbps,int burst);
+
+void sendReport();
+
 void generalSend(char fileName[],char *data,char *intname,uint16_t name_len);
 
 void pngSend(char fileName[],char *data,char *intname,uint16_t name_len);
@@ -1,13 +1,147 @@
 //File Sender Supplement - Christopher Moore
 //Contains different methods of breaking up files to send
 
+#define _FILE_OFFSET_BITS 64 //64-bit file offsets for files over 2GB on 32-bit systems
+
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include "sendFunctions5.h"
 #include "lodepng.h"
 #include "zlib.h"
+#include "codec.h"
+#include "fec.h"
+
+#define COMPRESS_THREADS 0 //Threads packing PNG regions in parallel(0 starts one per online core)
+#define PACK_REGION (256*1024) //Minimum bytes of the image a worker packs into frames at a time(only the last frame of a region can be part full)
+#define PACK_WINDOW 16 //Number of packed regions that can wait to be sent
+#define PACK_SLACK 16 //Unused bytes at the end of a frame below which the packer stops adding streams
+#define PACK_MARGIN 32 //The first stream in a frame aims to leave 1/PACK_MARGIN of the frame for smaller streams
+#define FILTER_TRIAL 32 //Every FILTER_TRIAL frames the PNG packer packs a frame both with and without row filtering and keeps the better
+#define PNG_META_COPIES 3 //Number of times the PNG metadata is sent, spread through the transfer
+#define PNG_META_OFFSET UINT64_MAX //Pixel offset(currSize) marking a PNG metadata frame
+#define INPUT_WINDOW (64*1024*1024) //Bytes of the input file generalSend and mp4Send map at once, more if one box needs it(must be a multiple of the page size)
+#define GEN_RAW_RUN 16 //General frames sent raw after one that did not compress, before compression is tried again
+#define FOUNTAIN_ROUND 16 //Fountain symbols sent for one block before fountainSend moves to the next
+#define FOUNTAIN_FRAME_MAX (BUFFER_SIZE-(FOUNTAIN_HEADER_SIZE+FEC_SYMBOL_EXTRA-FRAME_HEADER_SIZE)) //Longest data frame of a fountain coded transfer, so its symbol fits in a frame
+
+//Region of the image packed into frame payloads, each the pixel offset(currSize) and codec followed by one or more streams
+//of filtered pixel data
+struct packedRegion
+{
+	char* payload;//Frame payloads, payload x starting at payload[x*BUFFER_SIZE]
+	uint16_t* len;//Length of each payload
+	uint32_t count;
+	uint32_t slots;//Number of payloads allocated
+	uint8_t ready;//Set once a worker has packed the region
+};
+
+//Rows of one width the image is sent as, the whole image or one Adam7 pass
+struct imagePass
+{
+	uint64_t start;//Offset of the pass in the image as sent
+	uint64_t end;
+	uint32_t stride;//Bytes in each row of the pass
+};
+
+//Regions of the image packed by worker threads ahead of the sender in pngSend
+struct regionQueue
+{
+	unsigned char* image;//Pixels in the order they are sent, Adam7 interlaced if pngProgressive is set
+	uint32_t imageSize;
+	uint32_t stride;//Bytes in each row of the image, the widest row of any pass
+	struct imagePass passes[7];
+	uint8_t passCount;
+	uint32_t passRegion[8];//First region of each pass, followed by regionCount
+	uint8_t bytesPerPixel;
+	uint8_t filter;//0 if rows are never filtered(palette and sub-byte images, as lodepng does)
+	uint8_t codec;
+	uint16_t payloadSize;//Bytes of each frame left after the PNG header
+	uint32_t regionSize;
+	uint32_t regionCount;
+	uint32_t nextRegion;//Next region a worker will pack
+	uint32_t sent;//Regions already sent, workers may pack up to sent+PACK_WINDOW
+	struct packedRegion regions[PACK_WINDOW];//Region x is kept in regions[x%PACK_WINDOW]
+	pthread_mutex_t lock;
+	pthread_cond_t slotFree;//Signalled when a region has been sent
+	pthread_cond_t regionDone;//Signalled when a worker finishes a region
+}packer;
+
+//Read-only mapping of part of the file being sent, moved along the file as it is read
+struct inputMap
+{
+	int fd;
+	uint64_t size;//Size of the file
+	const uint8_t* map;//NULL until the first mapInput call
+	uint64_t mapStart;//Offset in the file of map
+	size_t mapLen;
+};
+
+//Top-level box of an MP4 file, found by indexBoxes
+struct mp4Box
+{
+	char name[5];
+	uint8_t headerSize;//8, or 16 for a box with a 64-bit size
+	uint64_t offset;//Offset in the file of the box header
+	uint64_t size;//Size of the box contents after the header
+};
+
+//Sample of an MP4 track, found by indexSamples
+struct mp4Sample
+{
+	uint64_t offset;//Offset in the file, or in the mdat box contents once mp4Send has placed it
+	uint32_t size;
+	uint8_t key;//1 for a keyframe listed in stss
+};
+
+//Parity frames of the erasure coding block being sent, built up as each data frame of the block is sent
+struct parityBlock
+{
+	uint8_t* frames;//fecParity frames of BUFFER_SIZE bytes, each with its parity symbol after FEC_HEADER_SIZE
+	uint8_t count;//Data frames in the block so far
+	uint16_t symbolSize;//Longest symbol in the block so far
+}parity;
+
+//Data sent as a fountain coded transfer, its data frames rebuilt from the mapped file whenever a symbol needs one
+struct fountainSource
+{
+	struct inputMap* input;
+	uint64_t start;//Offset in the file of the data
+	uint64_t size;//Bytes of data
+	const char* header;//Header of every data frame, starting with the file type
+	uint16_t headerSize;
+	uint16_t offsetPos;//Position in the header of the 64-bit offset of the frame's data
+	uint16_t lengthPos;//Position in the header of the 32-bit length of the frame's data, 0 if there is none
+	uint16_t dataSize;//Bytes of data in every frame but the last
+};
+
+uint8_t payloadCodec = CODEC_ZLIB(9);//Codec for PNG pixels, moov and general data, set by setCompressionProfile
+uint8_t pngProgressive = 0;//Sends PNG pixels as Adam7 passes, set by setPngProgressive
+uint8_t keyframeCopies = 1;//Extra copies sent of mdat frames holding keyframe samples, set by setKeyframeCopies
+uint16_t frameSize = BUFFER_SIZE;//Longest frame the send paths build, shorter while parity frames need room for the symbol length, set by setFec
+uint8_t fecData = 0;//Data frames in each erasure coding block, 0 when no parity is sent, set by setFec
+uint8_t fecParity = 0;//Parity frames sent after each block
+//Token bucket in front of send_vmac, and totals of what was sent for sendReport
+struct sendPacer
+{
+	double rate;//Bytes per second the bucket fills at, 0 when sends are not paced
+	double burst;//Bytes the bucket holds, the most sent back to back
+	double tokens;//Bytes that can be sent now
+	long long refilled;//Monotonic time(ns) tokens was last topped up
+	long long start;//Monotonic time(ns) of the first frame sent
+	long long end;//Monotonic time(ns) the last frame was handed to send_vmac
+	uint64_t frames;
+	uint64_t bytes;
+}pacer;
+
+uint16_t fountainOverhead = 0;//Fountain symbols sent for each block beyond the FOUNTAIN_MARGIN a lossless link needs, in percent of its data frames, 0 when fountain coding is off, set by setFountain
 
 /**
  *  changeEndian  - Change endianness
@@ -24,31 +158,806 @@ uint32_t changeEndian(uint32_t x)
 }
 
 /**
- *  findMaxUncompData  - Inverse compressBound
+ *  setCompressionProfile  - Chooses the payload codec
+ *
+ *  Sets the codec used by every send function from a PROFILE_ value, trading sender CPU time for airtime.
+ *	
+ *	Arguments :
+ *	@profile : PROFILE_FASTEST, PROFILE_BALANCED or PROFILE_SMALLEST.
+ */
+void setCompressionProfile(int profile)
+{
+	payloadCodec = profileCodec(profile);
+}
+
+/**
+ *  setPngProgressive  - Chooses the PNG pixel order
+ *
+ *  Sets whether pngSend sends pixels as the 7 Adam7 passes, coarse to fine, rather than row by row. A receiver can then make
+ *	a full size lower resolution image from the first part of the transfer. Images under 8 bits per pixel are always sent
+ *	row by row.
+ *	
+ *	Arguments :
+ *	@progressive : 1 for Adam7 order, 0 for row order.
+ */
+void setPngProgressive(int progressive)
+{
+	pngProgressive = (progressive != 0);
+}
+
+/**
+ *  setKeyframeCopies  - Chooses the redundancy of MP4 keyframes
  *
- *  Finds the compressBound input value at which the compressBound output is equal to or less than the function input.
+ *  Sets how many extra copies mp4Send sends of every mdat frame holding part of a keyframe sample, so the frames the rest
+ *	of the video is decoded from survive more loss than the rest of mdat. Limited to KEYFRAME_COPIES_MAX.
  *	
  *	Arguments :
- *	@desiredCompSize : desired output of compressBound.
+ *	@copies : Extra copies, 0 to send keyframes once like the rest of mdat.
  */
-uint16_t findMaxUncompData(uLong desiredCompSize)
+void setKeyframeCopies(int copies)
 {
-	for(int x = 0;;x++)
+	keyframeCopies = (copies < 0 ? 0 : (copies > KEYFRAME_COPIES_MAX ? KEYFRAME_COPIES_MAX : copies));
+}
+
+/**
+ *  setFec  - Chooses the erasure coding
+ *
+ *  Sets every send path to follow each block of data frames with parity frames, so the receiver can rebuild as many lost
+ *	frames of the block as there are parity frames. Data frames are built FEC_HEADER_SIZE+FEC_SYMBOL_EXTRA-FRAME_HEADER_SIZE
+ *	bytes short of BUFFER_SIZE so their parity frames fit in BUFFER_SIZE. Must be called before anything is sent.
+ *	
+ *	Arguments :
+ *	@data : Data frames in each block, up to FEC_MAX_DATA, or 0 for no erasure coding.
+ *	@parityCount : Parity frames sent for each block, up to FEC_MAX_PARITY, or 0 for no erasure coding.
+ */
+void setFec(int data,int parityCount)
+{
+	if(data <= 0 || parityCount <= 0)
+	{
+		fecData = 0;
+		frameSize = BUFFER_SIZE;
+		return;
+	}
+	fecData = (data > FEC_MAX_DATA ? FEC_MAX_DATA : data);
+	fecParity = (parityCount > FEC_MAX_PARITY ? FEC_MAX_PARITY : parityCount);
+	frameSize = BUFFER_SIZE-(FEC_HEADER_SIZE+FEC_SYMBOL_EXTRA-FRAME_HEADER_SIZE);
+	
+	free(parity.frames);
+	parity.frames = calloc(fecParity,BUFFER_SIZE);
+	if(parity.frames == NULL)
 	{
-		if(compressBound(x)>desiredCompSize)
+		printf("Error! Could not allocate parity frames\n");
+		exit(-1);
+	}
+}
+
+/**
+ *  setFountain  - Chooses fountain coding of bulk data
+ *
+ *  Sets generalSend and the mdat part of mp4Send to send their data as fountain symbols rather than data frames. Each block
+ *	of data frames is sent as FOUNTAIN_MARGIN more symbols than it has frames, plus overhead percent of its frame count to
+ *	cover loss, and a receiver decodes it from any symbols slightly over its frame count. Fountain coded data is sent raw,
+ *	as symbols are built from data frames that must be rebuilt the same way from the file at any time.
+ *	
+ *	Arguments :
+ *	@overhead : Symbols for loss in percent of the data frames, up to FOUNTAIN_OVERHEAD_MAX, or 0 for no fountain coding.
+ */
+void setFountain(int overhead)
+{
+	fountainOverhead = (overhead < 0 ? 0 : (overhead > FOUNTAIN_OVERHEAD_MAX ? FOUNTAIN_OVERHEAD_MAX : overhead));
+}
+
+/**
+ *  setPacing  - Chooses the send rate
+ *
+ *  Paces every frame handed to send_vmac with a token bucket, so frames leave at the target rate on average and at most
+ *	burst frames' worth of bytes go out back to back rather than overrunning the driver queue.
+ *	
+ *	Arguments :
+ *	@kbps : Target rate in kbit/s of frame bytes, or 0 to send as fast as send_vmac takes frames.
+ *	@burst : Frames of BUFFER_SIZE bytes the bucket holds, at least 1.
+ */
+void setPacing(int kbps,int burst)
+{
+	pacer.rate = (kbps > 0 ? kbps*1000.0/8 : 0);
+	pacer.burst = (double)(burst > 1 ? burst : 1)*BUFFER_SIZE;
+	pacer.tokens = pacer.burst;
+	pacer.refilled = 0;
+}
+
+/**
+ *  packFrame  - Exact-fill frame compression
+ *
+ *  Fills out with complete codec streams holding consecutive data from in, so every frame can be decompressed on its own.
+ *	The first stream is sized from the compression ratio seen so far to take most of the frame, and smaller streams fill
+ *	the space it leaves until less than PACK_SLACK bytes remain. Only a stream that turns out too large is compressed again.
+ *	
+ *	Arguments :
+ *	@codec : Codec id.
+ *	@in : Data to compress.
+ *	@inSize : Size of in.
+ *	@out : Buffer for the streams.
+ *	@outSize : Size of out.
+ *	@outLen : Set to the total length of the streams.
+ *	@ratio : Input bytes per output byte of recent first streams, updated by each frame.
+ *
+ *	Returns the number of bytes of in compressed into the frame.
+ */
+uLong packFrame(uint8_t codec, const Bytef* in, uLong inSize, Bytef* out, uInt outSize, uInt* outLen, double* ratio)
+{
+	uLong consumed = 0;
+	*outLen = 0;
+	while(consumed < inSize && outSize - *outLen > PACK_SLACK)
+	{
+		uInt space = outSize - *outLen;
+		uLong tryIn = (*outLen == 0 ? *ratio*(space - space/PACK_MARGIN) : *ratio*(space - PACK_SLACK/2));//The first stream aims short of the frame so it normally fits first time
+		if(tryIn > inSize-consumed)
+		{
+			tryIn = inSize-consumed;
+		}
+		
+		uInt streamLen = 0;
+		while(tryIn > 0 && (streamLen = codecCompress(codec,&in[consumed],tryIn,&out[*outLen],space)) == 0)
+		{
+			tryIn -= (*outLen == 0 ? tryIn/2 : (tryIn+7)/8);//Later streams fill whatever the first one leaves
+		}
+		if(tryIn == 0)
 		{
-			return x-1;
+			break;
 		}
+		
+		double streamRatio = (double)tryIn/streamLen;
+		if((*outLen == 0 || streamLen > outSize/4) && (consumed+tryIn < inSize || streamRatio > *ratio))//Small streams compress worse, so they only set the ratio when nothing better has
+		{
+			*ratio = streamRatio;//A stream that took the rest of in only shows the ratio is at least this
+		}
+		consumed += tryIn;
+		*outLen += streamLen;
+	}
+	return consumed;
+}
+
+/**
+ *  rowAbove  - Row above a row segment
+ *
+ *  Copies the length bytes above the row segment at pos into above, with 0 in place of bytes before start so a frame
+ *	starting at start can be filtered and unfiltered without the frames before it.
+ *	
+ *	Arguments :
+ *	@pass : Pass the frame is in.
+ *	@start : Offset in the image of the first byte in the frame.
+ *	@pos : Offset in the image of the row segment.
+ *	@length : Length of the row segment.
+ *	@above : Buffer of at least length bytes.
+ */
+void rowAbove(struct imagePass* pass, uint64_t start, uint64_t pos, uint32_t length, unsigned char* above)
+{
+	uint32_t zeros = (pos >= start+pass->stride ? 0 : start+pass->stride-pos);
+	if(zeros > length)
+	{
+		zeros = length;
+	}
+	memset(above,0,zeros);
+	memcpy(&above[zeros],&packer.image[pos+zeros-pass->stride],length-zeros);
+}
+
+/**
+ *  filterFrame  - Frame row filtering
+ *
+ *  Applies PNG filter method 0 to pixels bytes of the image from pos, writing each row segment(the part of a row in the
+ *	frame) as its filter type followed by the filtered bytes. The type is chosen per segment as the one with the smallest
+ *	sum of absolute filtered values, lodepng's default heuristic. A frame can be filtered in several calls as long as
+ *	every call but the last ends on a row boundary.
+ *	
+ *	Arguments :
+ *	@pass : Pass the frame is in.
+ *	@start : Offset in the image of the first byte in the frame.
+ *	@pos : Offset in the image of the first byte to filter.
+ *	@pixels : Number of image bytes to filter.
+ *	@filter : 0 to send every segment with filter type 0.
+ *	@out : Buffer for the filtered data, pixels plus one byte per row segment.
+ *	@scratch : 6*stride bytes of working space.
+ *
+ *	Returns the length of the filtered data.
+ */
+uint32_t filterFrame(struct imagePass* pass, uint64_t start, uint64_t pos, uint32_t pixels, uint8_t filter, unsigned char* out, unsigned char* scratch)
+{
+	unsigned char* above = scratch;
+	unsigned char* attempt = &scratch[pass->stride];//One row for each filter type
+	uint32_t outLen = 0;
+	uint64_t end = pos+pixels;
+	while(pos<end)
+	{
+		uint32_t length = pass->stride - (pos-pass->start)%pass->stride;
+		if(length > end-pos)
+		{
+			length = end-pos;
+		}
+		
+		unsigned char type = 0;
+		unsigned char* filtered = &packer.image[pos];
+		if(filter)
+		{
+			uint64_t smallest = UINT64_MAX;
+			rowAbove(pass,start,pos,length,above);
+			for(unsigned char x = 0;x<5;x++)
+			{
+				unsigned char* line = &attempt[x*pass->stride];
+				lodepng_filter_scanline(line,&packer.image[pos],above,length,packer.bytesPerPixel,x);
+				uint64_t sum = 0;
+				for(uint32_t y = 0;y<length;y++)
+				{
+					sum += (line[y] < 128 ? line[y] : 256-line[y]);
+				}
+				if(sum < smallest)
+				{
+					smallest = sum;
+					type = x;
+					filtered = line;
+				}
+			}
+		}
+		
+		out[outLen++] = type;
+		memcpy(&out[outLen],filtered,length);
+		outLen += length;
+		pos += length;
+	}
+	return outLen;
+}
+
+/**
+ *  filteredPixels  - Image bytes in filtered data
+ *
+ *  Returns the number of image bytes held by the first filteredLen bytes of data filtered by filterFrame from start in pass.
+ */
+uint32_t filteredPixels(struct imagePass* pass, uint64_t start, uint32_t filteredLen)
+{
+	uint32_t pixels = 0;
+	uint64_t pos = start;
+	while(filteredLen > 1)//Drops the filter type byte of each segment
+	{
+		uint32_t length = pass->stride - (pos-pass->start)%pass->stride;
+		if(length > filteredLen-1)
+		{
+			length = filteredLen-1;
+		}
+		filteredLen -= 1+length;
+		pixels += length;
+		pos += length;
+	}
+	return pixels;
+}
+
+/**
+ *  packImageFrame  - PNG frame packing
+ *
+ *  Filters the image from start a few rows at a time and packs it into payload until the frame is full.
+ *	
+ *	Arguments :
+ *	@pass : Pass the region being packed is in.
+ *	@start : Offset in the image of the first byte in the frame.
+ *	@end : Offset in the image where the region being packed ends.
+ *	@filter : 0 to send every row segment with filter type 0.
+ *	@payload : Buffer for the frame payload.
+ *	@len : Set to the length of the payload.
+ *	@ratio : Input bytes per output byte for this filter setting, updated by the frame.
+ *	@filtered : FRAME_DATA_MAX + 6*stride bytes of working space.
+ *
+ *	Returns the number of image bytes in the frame.
+ */
+uint64_t packImageFrame(struct imagePass* pass, uint64_t start, uint64_t end, uint8_t filter, char* payload, uint16_t* len, double* ratio, unsigned char* filtered)
+{
+	uint16_t space = packer.payloadSize-sizeof(start)-1;
+	uInt payloadLen = 0;
+	memcpy(payload,&start,sizeof(start));
+	payload[sizeof(start)] = packer.codec;
+	
+	//Only as much of the image as the frame is likely to take is filtered, in whole rows so more can be filtered
+	//and packed after it if the frame is not full, and never more than FRAME_DATA_MAX with the type bytes
+	uint64_t frameEnd = start + (uint64_t)(FRAME_DATA_MAX-2)*pass->stride/(pass->stride+1);
+	frameEnd = (frameEnd < end ? frameEnd : end);
+	uint64_t filteredEnd = start;
+	uint32_t filteredLen = 0;
+	uLong consumed = 0;
+	do
+	{
+		uint64_t windowEnd = filteredEnd + (uint64_t)((*ratio*2+1)*(space-payloadLen));
+		windowEnd += pass->stride - (windowEnd-pass->start)%pass->stride;
+		windowEnd = (windowEnd < frameEnd ? windowEnd : frameEnd);
+		filteredLen += filterFrame(pass,start,filteredEnd,windowEnd-filteredEnd,filter,&filtered[filteredLen],&filtered[FRAME_DATA_MAX]);
+		filteredEnd = windowEnd;
+		
+		uInt streamLen;
+		consumed += packFrame(packer.codec,&filtered[consumed],filteredLen-consumed,(Bytef *)&payload[sizeof(start)+1+payloadLen],space-payloadLen,&streamLen,ratio);
+		payloadLen += streamLen;
+	}while(consumed == filteredLen && space-payloadLen > PACK_SLACK && filteredEnd < frameEnd);
+	
+	*len = sizeof(start)+1+payloadLen;
+	return filteredPixels(pass,start,consumed);
+}
+
+/**
+ *  packWorker  - Region packing thread
+ *
+ *  Packs regions of the image into frame payloads in order of region number, staying at most PACK_WINDOW regions ahead of the sender.
+ */
+void* packWorker(void* arg)
+{
+	unsigned char* filtered = malloc(FRAME_DATA_MAX + 6*packer.stride);
+	char* trial = malloc(BUFFER_SIZE);
+	if(filtered == NULL || trial == NULL)
+	{
+		printf("Error! Could not allocate filter buffers\n");
+		exit(-1);
+	}
+	
+	while(1)
+	{
+		pthread_mutex_lock(&packer.lock);
+		while(packer.nextRegion < packer.regionCount && packer.nextRegion >= packer.sent + PACK_WINDOW)
+		{
+			pthread_cond_wait(&packer.slotFree,&packer.lock);
+		}
+		if(packer.nextRegion >= packer.regionCount)
+		{
+			pthread_mutex_unlock(&packer.lock);
+			releaseCodecs();
+			free(filtered);
+			free(trial);
+			return NULL;
+		}
+		uint32_t region = packer.nextRegion++;
+		pthread_mutex_unlock(&packer.lock);
+		
+		struct packedRegion* packed = &packer.regions[region%PACK_WINDOW];
+		uint8_t p = 0;
+		while(region >= packer.passRegion[p+1])
+		{
+			p++;
+		}
+		struct imagePass* pass = &packer.passes[p];
+		uint64_t currSize = pass->start + (uint64_t)(region-packer.passRegion[p])*packer.regionSize;
+		uint64_t end = (pass->end-currSize < packer.regionSize ? pass->end : currSize+packer.regionSize);
+		double ratio[2] = {2,2};//Input bytes per output byte without and with row filtering, refined by every frame
+		uint8_t filterRows = packer.filter;
+		uint32_t frame = 0;
+		
+		packed->count = 0;
+		while(currSize<end)
+		{
+			if(packed->count == packed->slots)
+			{
+				packed->slots = (packed->slots ? packed->slots*2 : 64);
+				packed->payload = realloc(packed->payload,(size_t)packed->slots*BUFFER_SIZE);
+				packed->len = realloc(packed->len,packed->slots*sizeof(uint16_t));
+				if(packed->payload == NULL || packed->len == NULL)
+				{
+					printf("Error! Could not allocate frame buffers\n");
+					exit(-1);
+				}
+			}
+			
+			char* payload = &packed->payload[(size_t)packed->count*BUFFER_SIZE];
+			uint64_t pixels;
+			if(packer.filter && frame%FILTER_TRIAL == 0)//Row filtering usually helps photographs and hurts drawings, so both are tried now and then
+			{
+				uint16_t trialLen;
+				uint64_t trialPixels = packImageFrame(pass,currSize,end,!filterRows,trial,&trialLen,&ratio[!filterRows],filtered);
+				pixels = packImageFrame(pass,currSize,end,filterRows,payload,&packed->len[packed->count],&ratio[filterRows],filtered);
+				if(trialPixels > pixels)
+				{
+					filterRows = !filterRows;
+					pixels = trialPixels;
+					memcpy(payload,trial,trialLen);
+					packed->len[packed->count] = trialLen;
+				}
+			}
+			else
+			{
+				pixels = packImageFrame(pass,currSize,end,filterRows,payload,&packed->len[packed->count],&ratio[filterRows],filtered);
+			}
+			currSize += pixels;
+			packed->count++;
+			frame++;
+		}
+		
+		pthread_mutex_lock(&packer.lock);
+		packed->ready = 1;
+		pthread_cond_broadcast(&packer.regionDone);
+		pthread_mutex_unlock(&packer.lock);
 	}
 }
 
 void send_vmac(uint16_t type, uint16_t rate, uint16_t seq, char *buff, uint16_t len, char * interest_name, uint16_t name_len);
 
 /**
- *  generalSend  - Sends unprocessed file data
+ *  monotonicNs  - Monotonic clock
  *
- *  Reads file and sends the data in the file with no modifications, using the provided data pointer as a buffer
- *	and intname/name_len as the interest input for send_vmac.
+ *  Returns the current CLOCK_MONOTONIC time in nanoseconds, which is not moved by changes to the system time.
+ */
+long long monotonicNs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return (long long)now.tv_sec*1000000000 + now.tv_nsec;
+}
+
+/**
+ *  pacedSend  - Sends a frame through the pacer
+ *
+ *  Tops up the token bucket for the time since the last frame and, if it holds fewer bytes than the frame, sleeps until
+ *	it will with an absolute clock_nanosleep, so the pacer neither spins nor drifts. Every send path sends through here so
+ *	parity and fountain frames are paced and counted with the data frames.
+ *	
+ *	Arguments :
+ *	@frame : Frame to send.
+ *	@len : Length of the frame.
+ *	@rate : Frame rate value passed to send_vmac.
+ *	@intname : Interest name
+ *	@name_len : Length of the interest name
+ */
+void pacedSend(char* frame,uint16_t len,int rate,char *intname,uint16_t name_len)
+{
+	long long now = monotonicNs();
+	if(pacer.frames == 0)
+	{
+		pacer.start = now;
+	}
+	if(pacer.rate > 0)
+	{
+		if(pacer.refilled == 0)
+		{
+			pacer.refilled = now;
+		}
+		pacer.tokens += (now-pacer.refilled)*pacer.rate/1e9;
+		if(pacer.tokens > pacer.burst)
+		{
+			pacer.tokens = pacer.burst;
+		}
+		pacer.refilled = now;
+		
+		if(pacer.tokens < len)
+		{
+			long long wake = now + (long long)((len-pacer.tokens)*1e9/pacer.rate);
+			struct timespec until = {.tv_sec = wake/1000000000, .tv_nsec = wake%1000000000};
+			while(clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&until,NULL) == EINTR);
+			pacer.tokens = len;
+			pacer.refilled = wake;
+		}
+		pacer.tokens -= len;
+	}
+	
+	send_vmac(1,rate,0,frame,len,intname,name_len);
+	pacer.frames++;
+	pacer.bytes += len;
+	pacer.end = monotonicNs();
+}
+
+/**
+ *  sendReport  - Prints the achieved send rate
+ *
+ *  Prints the frames and bytes handed to send_vmac so far and their rate from the first frame to the last.
+ */
+void sendReport()
+{
+	double seconds = (pacer.end-pacer.start)/1e9;
+	if(seconds <= 0)
+	{
+		seconds = 1e-9;
+	}
+	printf("Sent %llu frames, %llu bytes in %.3fs: %.0f frames/s, %.0f bytes/s",(unsigned long long)pacer.frames,(unsigned long long)pacer.bytes,seconds,pacer.frames/seconds,pacer.bytes/seconds);
+	if(pacer.rate > 0)
+	{
+		printf(" (paced at %.0f bytes/s, %.0f byte bursts)",pacer.rate,pacer.burst);
+	}
+	printf("\n");
+}
+
+uint32_t frameSequence = 0;//Sequence of the next frame sent
+char joinedFrame[BUFFER_SIZE];//Frames whose header and payload are apart are joined here for send_vmac
+
+/**
+ *  flushParity  - Sends the parity frames of the current block
+ *
+ *  Sends fecParity parity frames straight after the last data frame of the block, so the receiver can find the block from
+ *	the sequence of any of them, then starts the next block. Called by each send path once its last frame is sent to cover
+ *	a part full block.
+ *	
+ *	Arguments :
+ *	@rate : Frame rate value passed to send_vmac.
+ *	@intname : Interest name
+ *	@name_len : Length of the interest name
+ */
+void flushParity(int rate,char *intname,uint16_t name_len)
+{
+	if(parity.count == 0)
+	{
+		return;
+	}
+	for(int x = 0;x<fecParity;x++)
+	{
+		char* frame = (char*)&parity.frames[(size_t)x*BUFFER_SIZE];
+		memcpy(frame,"FEC",3);
+		memcpy(&frame[3],&frameSequence,sizeof(frameSequence));
+		frameSequence++;
+		frame[FRAME_HEADER_SIZE] = parity.count;
+		frame[FRAME_HEADER_SIZE+1] = x;
+		pacedSend(frame,FEC_HEADER_SIZE+parity.symbolSize,rate,intname,name_len);
+	}
+	memset(parity.frames,0,(size_t)fecParity*BUFFER_SIZE);
+	parity.count = 0;
+	parity.symbolSize = 0;
+}
+
+/**
+ *  addParity  - Adds a data frame to the parity of the current block
+ *
+ *  The frame's symbol is its 16-bit length after the frame header followed by those bytes, so a rebuilt frame gets its
+ *	length back. The file type and sequence are left out as the receiver knows both. Sends the parity frames once the block
+ *	holds fecData frames.
+ *	
+ *	Arguments :
+ *	@frame : Data frame as sent.
+ *	@len : Length of the frame, at most frameSize.
+ *	@rate : Frame rate value passed to send_vmac.
+ *	@intname : Interest name
+ *	@name_len : Length of the interest name
+ */
+void addParity(const char* frame,uint16_t len,int rate,char *intname,uint16_t name_len)
+{
+	uint8_t symbol[BUFFER_SIZE];
+	uint16_t dataLen = len-FRAME_HEADER_SIZE;
+	memcpy(symbol,&dataLen,sizeof(dataLen));
+	memcpy(&symbol[sizeof(dataLen)],&frame[FRAME_HEADER_SIZE],dataLen);
+	uint16_t symbolSize = sizeof(dataLen)+dataLen;
+	
+	for(int x = 0;x<fecParity;x++)
+	{
+		gfMulAdd(&parity.frames[(size_t)x*BUFFER_SIZE+FEC_HEADER_SIZE],symbol,fecCoefficient(x,parity.count),symbolSize);
+	}
+	if(symbolSize > parity.symbolSize)
+	{
+		parity.symbolSize = symbolSize;
+	}
+	parity.count++;
+	if(parity.count == fecData)
+	{
+		flushParity(rate,intname,name_len);
+	}
+}
+
+/**
+ *  sendFrames  - Sends a batch of data frames
+ *
+ *  Stamps the next frame sequence after the 3 character file type at the start of each frame and sends the frames in order.
+ *	The receiver orders and indexes frames by this sequence rather than the 16-bit V-MAC seq, which wraps after 65,536 frames.
+ *	
+ *	send_vmac takes a frame as one buffer, so a frame is only copied when its payload does not already follow its header.
+ *	With erasure coding on, every fecData frames are followed by fecParity parity frames.
+ *	A payload can be in read-only memory such as a mapped file, and frames can share one header buffer.
+ *	
+ *	Arguments :
+ *	@frames : Frames to send.
+ *	@count : Number of frames.
+ *	@rate : Frame rate value passed to send_vmac.
+ *	@intname : Interest name
+ *	@name_len : Length of the interest name
+ */
+void sendFrames(struct frameParts* frames,int count,int rate,char *intname,uint16_t name_len)
+{
+	for(int x = 0;x<count;x++)
+	{
+		char* buff = frames[x].header.iov_base;
+		uint16_t len = frames[x].header.iov_len + frames[x].payloadLen;
+		if(frames[x].payloadLen != 0 && frames[x].payload != &buff[frames[x].header.iov_len])
+		{
+			memcpy(joinedFrame,buff,frames[x].header.iov_len);
+			memcpy(&joinedFrame[frames[x].header.iov_len],frames[x].payload,frames[x].payloadLen);
+			buff = joinedFrame;
+		}
+		
+		memcpy(&buff[3],&frameSequence,sizeof(frameSequence));
+		frameSequence++;
+		pacedSend(buff,len,rate,intname,name_len);
+		if(fecData != 0)
+		{
+			addParity(buff,len,rate,intname,name_len);
+		}
+	}
+}
+
+/**
+ *  sendFrame  - Sends a data frame
+ *
+ *  Sends a frame held in one buffer through sendFrames.
+ *	
+ *	Arguments :
+ *	@data : Frame to send, with FRAME_HEADER_SIZE bytes reserved at the start.
+ *	@len : Length of the frame including the frame header.
+ *	@rate : Frame rate value passed to send_vmac.
+ *	@intname : Interest name
+ *	@name_len : Length of the interest name
+ */
+void sendFrame(char *data,uint16_t len,int rate,char *intname,uint16_t name_len)
+{
+	struct frameParts frame = {.header = {.iov_base = data, .iov_len = len}, .payload = NULL, .payloadLen = 0};
+	sendFrames(&frame,1,rate,intname,name_len);
+}
+
+/**
+ *  openInput  - Opens a file for mapped reading
+ *
+ *  Opens the file to send and hints the kernel that it will be read from start to end, so read-ahead runs well in front
+ *	of the mapping. Exits if the file cannot be opened.
+ *	
+ *	Arguments :
+ *	@input : Mapping to set up.
+ *	@fileName : Filename of file to read from.
+ */
+void openInput(struct inputMap* input, char fileName[])
+{
+	input->fd = open(fileName, O_RDONLY);
+	if(input->fd < 0)
+	{
+		printf("Error! Could not open file\n");
+		exit(-1);
+	}
+	
+	input->size = lseek(input->fd, 0, SEEK_END);
+	input->map = NULL;
+	input->mapStart = 0;
+	input->mapLen = 0;
+	posix_fadvise(input->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+/**
+ *  mapInput  - Mapped file lookup
+ *
+ *  Returns a pointer to len bytes of the file from offset, moving the mapping if they are not all in it. The mapping is
+ *	INPUT_WINDOW bytes, or as long as the range if that is longer, so the returned pointer is only valid until the next call.
+ *	
+ *	Arguments :
+ *	@input : Mapping from openInput.
+ *	@offset : Offset in the file of the first byte.
+ *	@len : Number of bytes needed. offset+len must not be past the end of the file.
+ */
+const uint8_t* mapInput(struct inputMap* input, uint64_t offset, size_t len)
+{
+	if(input->map == NULL || offset < input->mapStart || offset+len > input->mapStart+input->mapLen)
+	{
+		if(input->map != NULL)
+		{
+			munmap((void*)input->map, input->mapLen);
+		}
+		
+		input->mapStart = offset - offset%sysconf(_SC_PAGESIZE);
+		input->mapLen = (offset+len-input->mapStart > INPUT_WINDOW ? offset+len-input->mapStart : INPUT_WINDOW);
+		if(input->mapLen > input->size-input->mapStart)
+		{
+			input->mapLen = input->size-input->mapStart;
+		}
+		input->map = mmap(NULL, input->mapLen, PROT_READ, MAP_PRIVATE, input->fd, (off_t)input->mapStart);
+		if(input->map == MAP_FAILED)
+		{
+			printf("Error! Could not map file\n");
+			exit(-1);
+		}
+		madvise((void*)input->map, input->mapLen, MADV_SEQUENTIAL);
+	}
+	return &input->map[offset-input->mapStart];
+}
+
+/**
+ *  closeInput  - Closes a mapped file
+ *
+ *  Unmaps and closes a file opened by openInput.
+ */
+void closeInput(struct inputMap* input)
+{
+	if(input->map != NULL)
+	{
+		munmap((void*)input->map, input->mapLen);
+	}
+	close(input->fd);
+}
+
+/**
+ *  fountainFrame  - Builds a data frame of a fountain coded transfer
+ *
+ *  Copies the header and the frame's data from the mapped file and sets its offset and length fields.
+ *	
+ *	Arguments :
+ *	@source : Data being sent.
+ *	@index : Position of the frame in the transfer.
+ *	@frame : Buffer for the frame, BUFFER_SIZE bytes.
+ *
+ *	Returns the length of the frame.
+ */
+uint16_t fountainFrame(struct fountainSource* source,uint64_t index,char* frame)
+{
+	uint64_t offset = index*source->dataSize;
+	uint32_t dataLen = (source->size-offset < source->dataSize ? source->size-offset : source->dataSize);
+	memcpy(frame,source->header,source->headerSize);
+	memcpy(&frame[source->offsetPos],&offset,sizeof(offset));
+	if(source->lengthPos != 0)
+	{
+		memcpy(&frame[source->lengthPos],&dataLen,sizeof(dataLen));
+	}
+	memcpy(&frame[source->headerSize],mapInput(source->input,source->start+offset,dataLen),dataLen);
+	return source->headerSize+dataLen;
+}
+
+/**
+ *  fountainSend  - Sends data as fountain symbols
+ *
+ *  Splits the data into frames, numbered with the next frame sequences but never sent, in blocks of FOUNTAIN_BLOCK. Each
+ *	symbol is the XOR of the fountainNeighbours of its ID in its block, over the same symbols addParity uses, so the receiver
+ *	can rebuild the frames it decodes. Symbols are sent FOUNTAIN_ROUND per block in turn, so a burst of loss is spread over
+ *	the blocks and the mapping moves once per block each round.
+ *	
+ *	Arguments :
+ *	@source : Data to send.
+ *	@rate : Frame rate value passed to send_vmac.
+ *	@intname : Interest name
+ *	@name_len : Length of the interest name
+ */
+void fountainSend(struct fountainSource* source,int rate,char *intname,uint16_t name_len)
+{
+	flushParity(rate,intname,name_len);//The data frames' sequences must follow each other, with no parity frame between
+	uint32_t frameCount = (source->size+source->dataSize-1)/source->dataSize;
+	uint32_t blockCount = (frameCount+FOUNTAIN_BLOCK-1)/FOUNTAIN_BLOCK;
+	uint32_t firstSeq = frameSequence;
+	frameSequence += frameCount;
+	uint16_t symbolSize = FEC_SYMBOL_EXTRA+source->headerSize-FRAME_HEADER_SIZE+source->dataSize;
+	
+	char frame[BUFFER_SIZE];
+	char part[BUFFER_SIZE];
+	uint16_t neighbours[FOUNTAIN_BLOCK];
+	memcpy(frame,"LTC",3);
+	memcpy(&frame[FRAME_HEADER_SIZE],source->header,3);
+	memcpy(&frame[FRAME_HEADER_SIZE+3],&firstSeq,sizeof(firstSeq));
+	memcpy(&frame[FRAME_HEADER_SIZE+3+sizeof(firstSeq)],&frameCount,sizeof(frameCount));
+	uint8_t* symbol = (uint8_t*)&frame[FOUNTAIN_HEADER_SIZE];
+	
+	int more = 1;
+	for(uint32_t round = 0;more;round++)
+	{
+		more = 0;
+		for(uint32_t block = 0;block<blockCount;block++)
+		{
+			uint16_t blockFrames = (frameCount-block*FOUNTAIN_BLOCK < FOUNTAIN_BLOCK ? frameCount-block*FOUNTAIN_BLOCK : FOUNTAIN_BLOCK);
+			uint32_t symbolCount = blockFrames+FOUNTAIN_MARGIN(blockFrames)+((uint32_t)blockFrames*fountainOverhead+99)/100;
+			uint32_t id = round*FOUNTAIN_ROUND;
+			for(;id<symbolCount && id<(round+1)*FOUNTAIN_ROUND;id++)
+			{
+				memset(symbol,0,symbolSize);
+				uint16_t degree = fountainNeighbours(block,id,blockFrames,neighbours);
+				for(uint16_t x = 0;x<degree;x++)
+				{
+					//The symbol of a frame is its length after the frame header then those bytes, so the length is written
+					//over the end of the sequence field to make the symbol one run
+					uint16_t dataLen = fountainFrame(source,(uint64_t)block*FOUNTAIN_BLOCK+neighbours[x],part)-FRAME_HEADER_SIZE;
+					memcpy(&part[FRAME_HEADER_SIZE-FEC_SYMBOL_EXTRA],&dataLen,sizeof(dataLen));
+					gfMulAdd(symbol,(uint8_t*)&part[FRAME_HEADER_SIZE-FEC_SYMBOL_EXTRA],1,FEC_SYMBOL_EXTRA+dataLen);
+				}
+				memcpy(&frame[FRAME_HEADER_SIZE+3+2*sizeof(uint32_t)],&block,sizeof(block));
+				memcpy(&frame[FRAME_HEADER_SIZE+3+3*sizeof(uint32_t)],&id,sizeof(id));
+				memcpy(&frame[3],&frameSequence,sizeof(frameSequence));
+				frameSequence++;
+				pacedSend(frame,FOUNTAIN_HEADER_SIZE+symbolSize,rate,intname,name_len);
+			}
+			more |= (id < symbolCount);
+		}
+	}
+}
+
+/**
+ *  generalSend  - Sends file data
+ *
+ *  Reads file and sends its data compressed with the payload codec, using the provided data pointer as a buffer
+ *	and intname/name_len as the interest input for send_vmac. Frames that do not compress are sent raw.
+ *	With fountain coding on, the file is sent raw as fountain symbols by fountainSend instead.
  *	
  *	Arguments :
  *	@fileName : Filename of file to read from.
@@ -58,40 +967,250 @@ void send_vmac(uint16_t type, uint16_t rate, uint16_t seq, char *buff, uint16_t
  */
 void generalSend(char fileName[],char *data,char *intname,uint16_t name_len)
 {
-	uint16_t len;
+	struct inputMap input;
+	openInput(&input,fileName);
 	
-	FILE *file = fopen(fileName, "rb");
+	uint16_t headerSize = 0;
+	memcpy(&data[headerSize],"GEN",3);//Sets beginning of every frame to be GEN
+	headerSize += FRAME_HEADER_SIZE;
 	
-	if (file == NULL) 
-    {   
-		printf("Error! Could not open file\n"); 
-        exit(-1);
-    }	
+	uint64_t currSize = 0;//Offset in the file of the data in the frame
+	uint32_t dataLen;//Bytes of file data in the frame once decompressed
+	uint64_t size = input.size;
+	//printf("Size %llu\n",size);
+	memcpy(&data[headerSize+sizeof(currSize)+sizeof(dataLen)],&size,sizeof(size));//Every frame carries the file size, so the receiver keeps the length when the last frames are lost
+	headerSize += sizeof(currSize) + sizeof(dataLen) + sizeof(size) + 1;//Followed by the codec
+	uint16_t payloadSize = frameSize - headerSize;
 	
-	//Finding file size
-	fseek(file,0,SEEK_END);
-	uint32_t size = ftell(file);
-	//printf("Size %d\n",size);
-	uint16_t bytesLeft = size%BUFFER_SIZE;//Finding stray bytes that need to be read
+	if(fountainOverhead != 0)
+	{
+		data[headerSize-1] = CODEC_RAW;
+		struct fountainSource source = {.input = &input, .start = 0, .size = size, .header = data, .headerSize = headerSize,
+			.offsetPos = FRAME_HEADER_SIZE, .lengthPos = FRAME_HEADER_SIZE+sizeof(currSize), .dataSize = FOUNTAIN_FRAME_MAX-headerSize};
+		fountainSend(&source,0,intname,name_len);
+		closeInput(&input);
+		return;
+	}
 	
-	//Reading and sending main data chunk
-	fseek(file,0,SEEK_SET);
-	for(int x = 0;x<(size/1024);x++)
+	double ratio = 2;//Input bytes per output byte, refined by every compressed frame
+	unsigned int rawRun = 0;//Frames left to send raw before compression is tried again
+	
+	//Reading and sending data, each frame compressed straight from the mapped file with up to PACK_REGION bytes to take from
+	while(currSize<size)
+	{
+		uint32_t inSize = (size-currSize < PACK_REGION ? size-currSize : PACK_REGION);
+		const Bytef* in = mapInput(&input,currSize,inSize);
+		
+		uint8_t codec = payloadCodec;
+		uInt streamLen = 0;
+		dataLen = 0;
+		if(rawRun > 0)
+		{
+			rawRun--;
+			codec = CODEC_RAW;
+		}
+		else if(codec != CODEC_RAW)
+		{
+			dataLen = packFrame(codec,in,inSize,(Bytef *)&data[headerSize],payloadSize,&streamLen,&ratio);
+			if(dataLen <= streamLen)//Raw data fills the frame with at least as much
+			{
+				rawRun = GEN_RAW_RUN;
+				codec = CODEC_RAW;
+			}
+		}
+		struct frameParts frame = {.header = {.iov_base = data, .iov_len = headerSize}, .payload = &data[headerSize], .payloadLen = streamLen};
+		if(codec == CODEC_RAW)//Raw frames are sent straight from the mapped file
+		{
+			dataLen = streamLen = (inSize<payloadSize?inSize:payloadSize);
+			frame.payload = in;
+			frame.payloadLen = dataLen;
+		}
+		
+		memcpy(&data[FRAME_HEADER_SIZE],&currSize,sizeof(currSize));
+		memcpy(&data[FRAME_HEADER_SIZE+sizeof(currSize)],&dataLen,sizeof(dataLen));
+		data[headerSize-1] = codec;
+		//printf("Len %u Stream %u\n",dataLen,streamLen);
+		sendFrames(&frame,1,0,intname,name_len);
+		currSize += dataLen;
+	}
+	flushParity(0,intname,name_len);
+	
+	closeInput(&input);
+}
+
+/**
+ *  pngMetadata  - Serializes the PNG image format and ancillary chunks
+ *
+ *  Writes bytesPerPixel, colortype, width, height and the pixel order followed by the bKGD, pHYs, iCCP, sRGB, cHRM and gAMA
+ *	chunks present in state and an "IDAT" end marker, in the order the receiver reads them.
+ *	
+ *	Arguments :
+ *	@state : State of the decoded PNG file.
+ *	@bytesPerPixel : Bytes in each pixel of the decoded image.
+ *	@width : Image width in pixels.
+ *	@height : Image height in pixels.
+ *	@interlace : 1 if the pixels are sent in Adam7 order, 0 if they are sent row by row.
+ *	@metaSize : Set to the length of the metadata.
+ *
+ *	Returns the metadata, which the caller frees.
+ */
+char* pngMetadata(LodePNGState* state,uint8_t bytesPerPixel,unsigned width,unsigned height,uint8_t interlace,uint32_t* metaSize)
+{
+	uint8_t colortype = state->info_png.color.colortype;
+	uint8_t profNameLen = (state->info_png.iccp_defined ? strlen(state->info_png.iccp_name) : 0);
+	char* meta = malloc(256 + profNameLen + (state->info_png.iccp_defined ? state->info_png.iccp_profile_size : 0));
+	if(meta == NULL)
 	{
-		fread(data,BUFFER_SIZE,1,file);
-		len = BUFFER_SIZE;
-		//printf("Len %d\n",len);
-		send_vmac(1,0,0,data,len,intname,name_len);
+		printf("Error! Could not allocate PNG metadata\n");
+		exit(-1);
 	}
+	uint32_t size = 0;
+	
+	memcpy(&meta[size],&bytesPerPixel,sizeof(bytesPerPixel));
+	size += sizeof(bytesPerPixel);
+	
+	memcpy(&meta[size],&colortype,sizeof(colortype));
+	size += sizeof(colortype);
 	
-	if(bytesLeft!=0)
+	memcpy(&meta[size],&width,sizeof(width));
+	size += sizeof(width);
+	
+	memcpy(&meta[size],&height,sizeof(height));
+	size += sizeof(height);
+	
+	memcpy(&meta[size],&interlace,sizeof(interlace));
+	size += sizeof(interlace);
+	
+	if(state->info_png.background_defined)//Checks for bKGD chunk and if present the data is written to the buffer
+	{
+		memcpy(&meta[size],"bKGD",4);
+		size += 4;
+		
+		memcpy(&meta[size],&state->info_png.background_r,sizeof(state->info_png.background_r));
+		size += sizeof(state->info_png.background_r);
+		
+		memcpy(&meta[size],&state->info_png.background_g,sizeof(state->info_png.background_g));
+		size += sizeof(state->info_png.background_g);
+		
+		memcpy(&meta[size],&state->info_png.background_b,sizeof(state->info_png.background_b));
+		size += sizeof(state->info_png.background_b);
+	}
+	if(state->info_png.phys_defined)//Checks for pHYs chunk and if present the data is written to the buffer
 	{
-		//Reading and sending stray data
-		fread(data,bytesLeft,1,file);
-		send_vmac(1,0,0,data,bytesLeft,intname,name_len);
+		memcpy(&meta[size],"pHYs",4);
+		size += 4;
+		
+		memcpy(&meta[size],&state->info_png.phys_x,sizeof(state->info_png.phys_x));
+		size += sizeof(state->info_png.phys_x);
+		
+		memcpy(&meta[size],&state->info_png.phys_y,sizeof(state->info_png.phys_y));
+		size += sizeof(state->info_png.phys_y);
+		
+		memcpy(&meta[size],&state->info_png.phys_unit,sizeof(state->info_png.phys_unit));
+		size += sizeof(state->info_png.phys_unit);
 	}
+	if(state->info_png.iccp_defined)//Checks for iCCP chunk and if present the data is written to the buffer
+	{
+		memcpy(&meta[size],"iCCP",4);
+		size += 4;
+		
+		memcpy(&meta[size],&profNameLen,sizeof(profNameLen));
+		size += sizeof(profNameLen);
+		
+		memcpy(&meta[size],state->info_png.iccp_name,profNameLen);
+		size += profNameLen;
+		
+		memcpy(&meta[size],&state->info_png.iccp_profile_size,sizeof(state->info_png.iccp_profile_size));
+		size += sizeof(state->info_png.iccp_profile_size);
+		
+		memcpy(&meta[size],state->info_png.iccp_profile,state->info_png.iccp_profile_size);
+		size += state->info_png.iccp_profile_size;
+	}
+	if(state->info_png.srgb_defined)
+	{
+		memcpy(&meta[size],"sRGB",4);
+		size += 4;
+		
+		memcpy(&meta[size],&state->info_png.srgb_intent,sizeof(state->info_png.srgb_intent));
+		size += sizeof(state->info_png.srgb_intent);
+	}
+	else//Only sends cHRM & gAMA if sRGB is not defined
+	{
+		if(state->info_png.chrm_defined)//Checks for cHRM chunk and if present the data is written to the buffer
+		{
+			memcpy(&meta[size],"cHRM",4);
+			size += 4;
+			
+			memcpy(&meta[size],&state->info_png.chrm_white_x,sizeof(state->info_png.chrm_white_x));
+			size += sizeof(state->info_png.chrm_white_x);
+			
+			memcpy(&meta[size],&state->info_png.chrm_white_y,sizeof(state->info_png.chrm_white_y));
+			size += sizeof(state->info_png.chrm_white_y);
+			
+			memcpy(&meta[size],&state->info_png.chrm_red_x,sizeof(state->info_png.chrm_red_x));
+			size += sizeof(state->info_png.chrm_red_x);
+			
+			memcpy(&meta[size],&state->info_png.chrm_red_y,sizeof(state->info_png.chrm_red_y));
+			size += sizeof(state->info_png.chrm_red_y);
+			
+			memcpy(&meta[size],&state->info_png.chrm_green_x,sizeof(state->info_png.chrm_green_x));
+			size += sizeof(state->info_png.chrm_green_x);
+			
+			memcpy(&meta[size],&state->info_png.chrm_green_y,sizeof(state->info_png.chrm_green_y));
+			size += sizeof(state->info_png.chrm_green_y);
+			
+			memcpy(&meta[size],&state->info_png.chrm_blue_x,sizeof(state->info_png.chrm_blue_x));
+			size += sizeof(state->info_png.chrm_blue_x);
+			
+			memcpy(&meta[size],&state->info_png.chrm_blue_y,sizeof(state->info_png.chrm_blue_y));
+			size += sizeof(state->info_png.chrm_blue_y);
+		}
+		
+		if(state->info_png.gama_defined)//Checks for gAMA chunk and if present the data is written to the buffer
+		{			
+			memcpy(&meta[size],"gAMA",4);
+			size += 4;
+			
+			memcpy(&meta[size],&state->info_png.gama_gamma,sizeof(state->info_png.gama_gamma));
+			size += sizeof(state->info_png.gama_gamma);
+		}
+	}
+	
+	memcpy(&meta[size],"IDAT",4);
+	size += 4;
+	
+	*metaSize = size;
+	return meta;
+}
+
+/**
+ *  sendPngMetadata  - Sends one copy of the PNG metadata
+ *
+ *  Splits the metadata into as many frames as it needs, each the PNG_META_OFFSET pixel offset, the metadata size and the
+ *	offset of the fragment within the metadata followed by the fragment.
+ *	
+ *	Arguments :
+ *	@data : Frame buffer with the PNG frame header already written.
+ *	@headerSize : Length of the PNG frame header.
+ *	@meta : Metadata from pngMetadata.
+ *	@metaSize : Length of meta.
+ *	@intname : Interest name
+ *	@name_len : Length of the interest name
+ */
+void sendPngMetadata(char *data,uint16_t headerSize,char *meta,uint32_t metaSize,char *intname,uint16_t name_len)
+{
+	const uint64_t metaMarker = PNG_META_OFFSET;
+	memcpy(&data[headerSize],&metaMarker,sizeof(metaMarker));
+	memcpy(&data[headerSize+sizeof(metaMarker)],&metaSize,sizeof(metaSize));
+	uint16_t fragHeaderSize = headerSize + sizeof(metaMarker) + sizeof(metaSize) + sizeof(uint32_t);
 	
-	fclose(file);
+	for(uint32_t metaOffset = 0;metaOffset<metaSize;metaOffset += frameSize - fragHeaderSize)
+	{
+		uint32_t fragSize = (metaSize-metaOffset < frameSize - fragHeaderSize ? metaSize-metaOffset : frameSize - fragHeaderSize);
+		memcpy(&data[fragHeaderSize-sizeof(metaOffset)],&metaOffset,sizeof(metaOffset));
+		memcpy(&data[fragHeaderSize],&meta[metaOffset],fragSize);
+		sendFrame(data,fragHeaderSize+fragSize,0,intname,name_len);
+	}
 }
 
 /**
@@ -100,6 +1219,11 @@ void generalSend(char fileName[],char *data,char *intname,uint16_t name_len)
  *  Uses PNG file to decode raw pixel data and sends raw pixel data with a header using the data pointer as a buffer
  *	and intname/name_len as the interest input for send_vmac.
  *	
+ *	The image format and ancillary chunks are sent PNG_META_COPIES times in dedicated metadata frames, so pixel frames only
+ *	carry the image ID and pixel offset.
+ *	
+ *	If setPngProgressive is set the pixels are sent as Adam7 passes, each pass packed as an image of its own.
+ *	
  *	Arguments :
  *	@fileName : Filename of file to read from.
  *	@data : Pointer to memory to be used as buffer for sending.
@@ -112,7 +1236,7 @@ void pngSend(char fileName[],char *data,char *intname,uint16_t name_len)//NOT RE
 	unsigned char* image;
 	unsigned width, height;
 	unsigned char* png = 0;
-	uint32_t pngsize;
+	size_t pngsize;
 	LodePNGState state;
 	
 	lodepng_state_init(&state);
@@ -135,191 +1259,449 @@ void pngSend(char fileName[],char *data,char *intname,uint16_t name_len)//NOT RE
 	
 	uint8_t colortype = state.info_png.color.colortype;
 	uint8_t bytesPerPixel = (state.info_png.color.bitdepth/8+(state.info_png.color.bitdepth%8!=0?1:0))*(colortype==0?1:(colortype==2?3:(colortype==4?2:4)));//Determines file color type
+	if(height != 0 && (uint64_t)bytesPerPixel*width > UINT32_MAX/height)//The receiver rejects metadata of an image this size
+	{
+		printf("Error! Image is too large to send\n");
+		exit(-1);
+	}
 	uint32_t imageSize = bytesPerPixel*width*height;
 	
 	//printf("BytesPerPixel: %u\n",bytesPerPixel);
 	
+	//Pixels are sent row by row as one pass, or reordered into the 7 Adam7 passes so the coarsest arrive first
+	uint8_t interlace = (pngProgressive && state.info_png.color.bitdepth >= 8);
+	if(interlace)
+	{
+		unsigned passw[7], passh[7];
+		size_t passstart[8];
+		lodepng_adam7_passes(passw,passh,passstart,width,height,bytesPerPixel*8);
+		
+		unsigned char* interlaced = malloc(imageSize);
+		if(interlaced == NULL)
+		{
+			printf("Error! Could not allocate interlaced image\n");
+			exit(-1);
+		}
+		lodepng_adam7_interlace(interlaced,image,width,height,bytesPerPixel*8);
+		free(image);
+		image = interlaced;
+		
+		packer.passCount = 7;
+		for(int x = 0;x<7;x++)
+		{
+			packer.passes[x].start = passstart[x];
+			packer.passes[x].end = passstart[x+1];
+			packer.passes[x].stride = bytesPerPixel*passw[x];
+		}
+	}
+	else
+	{
+		packer.passCount = 1;
+		packer.passes[0].start = 0;
+		packer.passes[0].end = imageSize;
+		packer.passes[0].stride = bytesPerPixel*width;
+	}
+	
+	uint32_t metaSize;
+	char* meta = pngMetadata(&state,bytesPerPixel,width,height,interlace,&metaSize);
+	uint16_t imageId = (uint16_t)(time(NULL) ^ getpid());//Lets the receiver tell frames of this image from stray frames of an earlier one
+	
 	uint16_t headerSize = 0;
 	memcpy(&data[headerSize],"PNG",3);//Sets beginning of every frame to be PNG
-	headerSize += 3;
+	headerSize += FRAME_HEADER_SIZE;
 	
-	memcpy(&data[headerSize],&bytesPerPixel,sizeof(bytesPerPixel));//Sets next bytes to be bytesPerPixel, colortype, width, and height for encoding
-	headerSize += sizeof(bytesPerPixel);
+	memcpy(&data[headerSize],&imageId,sizeof(imageId));//Every frame only carries the image ID, the format and chunks are sent in the metadata frames
+	headerSize += sizeof(imageId);
 	
-	memcpy(&data[headerSize],&colortype,sizeof(colortype));
-	headerSize += sizeof(colortype);
+	//Frames are filled exactly by worker threads packing regions of the image, and sent here in order
+	packer.image = image;
+	packer.imageSize = imageSize;
+	packer.stride = bytesPerPixel*width;
+	packer.bytesPerPixel = bytesPerPixel;
+	packer.filter = (colortype != 3 && state.info_png.color.bitdepth >= 8);
+	packer.codec = payloadCodec;
+	packer.payloadSize = frameSize - headerSize;
+	pthread_mutex_init(&packer.lock,NULL);
+	pthread_cond_init(&packer.slotFree,NULL);
+	pthread_cond_init(&packer.regionDone,NULL);
 	
-	memcpy(&data[headerSize],&width,sizeof(width));
-	headerSize += sizeof(width);
-	
-	memcpy(&data[headerSize],&height,sizeof(height));
-	headerSize += sizeof(height);
+	long threadCount = (COMPRESS_THREADS > 0 ? COMPRESS_THREADS : sysconf(_SC_NPROCESSORS_ONLN));
+	if(threadCount < 1)
+	{
+		threadCount = 1;
+	}
+	//Few large regions keep part full frames rare, with enough of them to keep every worker busy
+	packer.regionSize = imageSize/(threadCount*4);
+	if(packer.regionSize < PACK_REGION)
+	{
+		packer.regionSize = PACK_REGION;
+	}
+	packer.passRegion[0] = 0;
+	for(int x = 0;x<packer.passCount;x++)//Regions never span two passes, so every frame holds rows of a single width
+	{
+		packer.passRegion[x+1] = packer.passRegion[x] + (packer.passes[x].end-packer.passes[x].start+packer.regionSize-1)/packer.regionSize;
+	}
+	packer.regionCount = packer.passRegion[packer.passCount];
+	pthread_t* workers = malloc(threadCount*sizeof(pthread_t));
+	for(long x = 0;x<threadCount;x++)
+	{
+		if(pthread_create(&workers[x],NULL,packWorker,NULL) != 0)
+		{
+			printf("Error! Could not start compression thread\n");
+			exit(-1);
+		}
+	}
 	
+	sendPngMetadata(data,headerSize,meta,metaSize,intname,name_len);//The first copy goes ahead of the pixels so the receiver can decode them as they arrive
+	uint32_t metaCopies = 1;
 	
-	if(state.info_png.background_defined)//Checks for bKGD chunk and if present the data is written to the buffer
+	for(uint32_t region = 0;region<packer.regionCount;region++)
 	{
-		memcpy(&data[headerSize],"bKGD",4);
-		headerSize += 4;
+		struct packedRegion* packed = &packer.regions[region%PACK_WINDOW];
+		pthread_mutex_lock(&packer.lock);
+		while(!packed->ready)
+		{
+			pthread_cond_wait(&packer.regionDone,&packer.lock);
+		}
+		pthread_mutex_unlock(&packer.lock);
 		
-		data[headerSize] = state.info_png.background_r;
-		headerSize += sizeof(state.info_png.background_r);
+		struct frameParts batch[SEND_BATCH];//Every frame shares the PNG header in data, with its payload sent from the region
+		for(uint32_t x = 0;x<packed->count;x += SEND_BATCH)
+		{
+			int count = (packed->count-x < SEND_BATCH ? packed->count-x : SEND_BATCH);
+			for(int y = 0;y<count;y++)
+			{
+				batch[y].header.iov_base = data;
+				batch[y].header.iov_len = headerSize;
+				batch[y].payload = &packed->payload[(size_t)(x+y)*BUFFER_SIZE];
+				batch[y].payloadLen = packed->len[x+y];
+				//printf("frame Size: %u\n",headerSize+packed->len[x+y]);
+			}
+			sendFrames(batch,count,0,intname,name_len);
+		}
 		
-		data[headerSize] = state.info_png.background_g;
-		headerSize += sizeof(state.info_png.background_g);
+		pthread_mutex_lock(&packer.lock);
+		packed->ready = 0;
+		packer.sent++;
+		pthread_cond_broadcast(&packer.slotFree);
+		pthread_mutex_unlock(&packer.lock);
 		
-		data[headerSize] = state.info_png.background_b;
-		headerSize += sizeof(state.info_png.background_b);
+		while(metaCopies < PNG_META_COPIES && (uint64_t)(region+1)*PNG_META_COPIES >= (uint64_t)metaCopies*packer.regionCount)//Spreads the other copies through the image
+		{
+			sendPngMetadata(data,headerSize,meta,metaSize,intname,name_len);
+			metaCopies++;
+		}
 	}
-	if(state.info_png.phys_defined)//Checks for pHYs chunk and if present the data is written to the buffer
+	
+	for(long x = 0;x<threadCount;x++)
 	{
-		memcpy(&data[headerSize],"pHYs",4);
-		headerSize += 4;
-		
-		data[headerSize] = state.info_png.phys_x;
-		headerSize += sizeof(state.info_png.phys_x);
-
-		data[headerSize] = state.info_png.phys_y;
-		headerSize += sizeof(state.info_png.phys_y);
-		
-		data[headerSize] = state.info_png.phys_unit;
-		headerSize += sizeof(state.info_png.phys_unit);
+		pthread_join(workers[x],NULL);
 	}
-	if(state.info_png.iccp_defined)//Checks for iCCP chunk and if present the data is written to the buffer
+	free(workers);
+	for(int x = 0;x<PACK_WINDOW;x++)
 	{
-		memcpy(&data[headerSize],"iCCP",4);
-		headerSize += 4;
-		
-		uint8_t profNameLen = strlen(state.info_png.iccp_name);
-		memcpy(&data[headerSize],&profNameLen,sizeof(profNameLen));
-		headerSize += sizeof(profNameLen);
-		
-		memcpy(&data[headerSize],state.info_png.iccp_name,profNameLen);
-		headerSize += profNameLen;
+		free(packer.regions[x].payload);
+		free(packer.regions[x].len);
+	}
+	pthread_mutex_destroy(&packer.lock);
+	pthread_cond_destroy(&packer.slotFree);
+	pthread_cond_destroy(&packer.regionDone);
 
-		data[headerSize] = state.info_png.iccp_profile_size;
-		headerSize += sizeof(state.info_png.iccp_profile_size);
-		
-		memcpy(&data[headerSize],state.info_png.iccp_profile,state.info_png.iccp_profile_size);
-		headerSize += state.info_png.iccp_profile_size;
+	flushParity(0,intname,name_len);
+
+	lodepng_state_cleanup(&state);
+	free(image);
+	free(meta);
+}
+
+/**
+ *  indexBoxes  - Indexes the top-level boxes of an MP4 file
+ *
+ *  Walks the box headers once from the start of the file, reading only the headers, so every box can be sent straight
+ *	from its offset without rescanning. A size of 1 is followed by a 64-bit largesize and a size of 0 runs to the end of
+ *	the file. A box cut short by the end of the file is indexed as far as it goes and a corrupt size ends the scan.
+ *	
+ *	Arguments :
+ *	@input : Mapped file to index.
+ *	@boxes : Set to a malloc'd array of the boxes found, in file order.
+ */
+uint32_t indexBoxes(struct inputMap* input, struct mp4Box** boxes)
+{
+	uint32_t boxCount = 0;
+	uint32_t boxSlots = 16;
+	*boxes = malloc(boxSlots*sizeof(struct mp4Box));
+	if(*boxes == NULL)
+	{
+		printf("Error! Could not allocate box index\n");
+		exit(-1);
 	}
-	if(state.info_png.srgb_defined)
+	
+	uint64_t pos = 0;//Offset in the file of the next box header
+	while(input->size-pos >= sizeof(uint32_t)+4)
 	{
-		memcpy(&data[headerSize],"sRGB",4);
-		headerSize += 4;
+		struct mp4Box box;
+		const uint8_t* header = mapInput(input,pos,sizeof(uint32_t)+4);
+		uint32_t size32;
+		memcpy(&size32,header,sizeof(size32));
+		size32 = changeEndian(size32);
+		memcpy(box.name,&header[sizeof(size32)],4);
+		box.name[4] = '\0';
+		box.offset = pos;
+		box.headerSize = sizeof(size32)+4;
+		
+		uint64_t boxSize = size32;
+		if(size32 == 1)//64-bit size after the name
+		{
+			if(input->size-pos < sizeof(size32)+4+sizeof(uint64_t))
+			{
+				break;
+			}
+			uint32_t sizeHalves[2];
+			memcpy(sizeHalves,&mapInput(input,pos,sizeof(size32)+4+sizeof(uint64_t))[sizeof(size32)+4],sizeof(sizeHalves));
+			boxSize = ((uint64_t)changeEndian(sizeHalves[0])<<32) | changeEndian(sizeHalves[1]);
+			box.headerSize += sizeof(uint64_t);
+		}
+		else if(size32 == 0)//Last box in the file
+		{
+			boxSize = input->size-pos;
+		}
+		if(boxSize < box.headerSize)
+		{
+			break;
+		}
+		if(boxSize > input->size-pos)
+		{
+			boxSize = input->size-pos;
+		}
+		box.size = boxSize-box.headerSize;
 		
-		data[headerSize] = state.info_png.srgb_intent;
-		headerSize += sizeof(state.info_png.srgb_intent);
+		if(boxCount == boxSlots)
+		{
+			boxSlots *= 2;
+			*boxes = realloc(*boxes,boxSlots*sizeof(struct mp4Box));
+			if(*boxes == NULL)
+			{
+				printf("Error! Could not allocate box index\n");
+				exit(-1);
+			}
+		}
+		(*boxes)[boxCount] = box;
+		boxCount++;
+		pos += boxSize;
 	}
-	else//Only sends cHRM & gAMA if sRGB is not defined
+	return boxCount;
+}
+
+/**
+ *  boxField  - Reads an MP4 box field
+ *
+ *  Returns the big-endian unsigned 32-bit integer at field.
+ *	
+ *	Arguments :
+ *	@field : First byte of the field.
+ */
+uint32_t boxField(const uint8_t* field)
+{
+	uint32_t x;
+	memcpy(&x,field,sizeof(x));
+	return changeEndian(x);
+}
+
+/**
+ *  findBox  - Finds a child box in the contents of an MP4 box
+ *
+ *  Returns the contents of the child box matching name and index, or NULL if there is none or a child box is corrupt.
+ *	
+ *	Arguments :
+ *	@box : Contents of the parent box.
+ *	@boxSize : Size of the parent box contents.
+ *	@name : 4 character name of the child box.
+ *	@index : Number of earlier boxes with the same name to skip.
+ *	@size : Set to the size of the child box contents.
+ */
+const uint8_t* findBox(const uint8_t* box, uint64_t boxSize, const char* name, uint32_t index, uint64_t* size)
+{
+	uint64_t pos = 0;
+	while(boxSize-pos >= sizeof(uint32_t)+4)
 	{
-		if(state.info_png.chrm_defined)//Checks for cHRM chunk and if present the data is written to the buffer
-		{			
-			memcpy(&data[headerSize],"cHRM",4);
-			headerSize += 4;
-			
-			data[headerSize] = state.info_png.chrm_white_x;
-			headerSize += sizeof(state.info_png.chrm_white_x);
-			
-			data[headerSize] = state.info_png.chrm_white_y;
-			headerSize += sizeof(state.info_png.chrm_white_y);
-			
-			data[headerSize] = state.info_png.chrm_red_x;
-			headerSize += sizeof(state.info_png.chrm_red_x);
-			
-			data[headerSize] = state.info_png.chrm_red_y;
-			headerSize += sizeof(state.info_png.chrm_red_y);
-			
-			data[headerSize] = state.info_png.chrm_green_x;
-			headerSize += sizeof(state.info_png.chrm_green_x);
-			
-			data[headerSize] = state.info_png.chrm_green_y;
-			headerSize += sizeof(state.info_png.chrm_green_y);
-			
-			data[headerSize] = state.info_png.chrm_blue_x;
-			headerSize += sizeof(state.info_png.chrm_blue_x);
-			
-			data[headerSize] = state.info_png.chrm_blue_y;
-			headerSize += sizeof(state.info_png.chrm_blue_y);
+		uint64_t childSize = boxField(&box[pos]);
+		uint8_t headerSize = sizeof(uint32_t)+4;
+		if(childSize == 1)
+		{
+			if(boxSize-pos < headerSize+sizeof(uint64_t))
+			{
+				return NULL;
+			}
+			childSize = ((uint64_t)boxField(&box[pos+headerSize])<<32) | boxField(&box[pos+headerSize+sizeof(uint32_t)]);
+			headerSize += sizeof(uint64_t);
+		}
+		else if(childSize == 0)
+		{
+			childSize = boxSize-pos;
+		}
+		if(childSize < headerSize || childSize > boxSize-pos)
+		{
+			return NULL;
 		}
 		
-		if(state.info_png.gama_defined)//Checks for gAMA chunk and if present the data is written to the buffer
-		{			
-			memcpy(&data[headerSize],"gAMA",4);
-			headerSize += 4;
-			
-			data[headerSize] = state.info_png.gama_gamma;
-			headerSize += sizeof(state.info_png.gama_gamma);
+		if(memcmp(&box[pos+sizeof(uint32_t)],name,4)==0)
+		{
+			if(index == 0)
+			{
+				*size = childSize-headerSize;
+				return &box[pos+headerSize];
+			}
+			index--;
 		}
+		pos += childSize;
 	}
+	return NULL;
+}
+
+/**
+ *  compareSamples  - Compares MP4 samples by offset
+ *
+ *  qsort comparison putting samples in file order.
+ *	
+ *	Arguments :
+ *	@a : First struct mp4Sample.
+ *	@b : Second struct mp4Sample.
+ */
+int compareSamples(const void* a, const void* b)
+{
+	const struct mp4Sample* x = a;
+	const struct mp4Sample* y = b;
+	return x->offset < y->offset ? -1 : (x->offset > y->offset);
+}
+
+/**
+ *  indexSamples  - Indexes the samples of every track in moov
+ *
+ *  Finds where each sample is in the file from the stbl box of each track: sizes from stsz, chunk offsets from stco or
+ *	co64 and the samples in each chunk from stsc. Samples listed in stss are marked as keyframes, and tracks without
+ *	stss have none marked as every sample is a sync sample. Tracks with missing or corrupt tables are left out.
+ *	
+ *	Arguments :
+ *	@moovData : Contents of the moov box.
+ *	@moovSize : Size of the moov box contents.
+ *	@samples : Set to a malloc'd array of the samples found, in file order.
+ */
+uint32_t indexSamples(const uint8_t* moovData, uint64_t moovSize, struct mp4Sample** samples)
+{
+	uint32_t sampleCount = 0;
+	uint32_t sampleSlots = 0;
+	*samples = NULL;
 	
-	memcpy(&data[headerSize],"IDAT",4);
-	headerSize += 4;
-	//printf("bytesperpixel %d width: %u height: %u headerSize: %u\n",bytesPerPixel,width,height,headerSize);
-	
-	Bytef outBuffer[BUFFER_SIZE];
-	uLongf outBufferSize;
-	
-	uint32_t currSize = 0;//Current total size of data that has been sent so far(excluding header)
-	uLong decompSize = (findMaxUncompData(BUFFER_SIZE)%bytesPerPixel!=0?findMaxUncompData(BUFFER_SIZE)/bytesPerPixel*bytesPerPixel:findMaxUncompData(BUFFER_SIZE));
-	
-	while(currSize<imageSize)
+	const uint8_t* trak;
+	uint64_t trakSize;
+	for(uint32_t track = 0;(trak = findBox(moovData,moovSize,"trak",track,&trakSize)) != NULL;track++)
 	{
-		uint16_t offset = 0;
-		uint16_t remainingFrameSize = BUFFER_SIZE - headerSize - sizeof(currSize);//Amount of data that can still be packed into frame
-		memcpy(&data[headerSize],&currSize,sizeof(currSize));
-		while(1)
+		uint64_t stblSize;
+		const uint8_t* stbl = findBox(trak,trakSize,"mdia",0,&stblSize);
+		if(stbl != NULL)
+		{
+			stbl = findBox(stbl,stblSize,"minf",0,&stblSize);
+		}
+		if(stbl != NULL)
+		{
+			stbl = findBox(stbl,stblSize,"stbl",0,&stblSize);
+		}
+		if(stbl == NULL)
+		{
+			continue;
+		}
+		
+		uint64_t stszSize, stscSize, chunksSize, stssSize = 0;
+		const uint8_t* stsz = findBox(stbl,stblSize,"stsz",0,&stszSize);
+		const uint8_t* stsc = findBox(stbl,stblSize,"stsc",0,&stscSize);
+		const uint8_t* stss = findBox(stbl,stblSize,"stss",0,&stssSize);
+		uint8_t offsetSize = sizeof(uint32_t);
+		const uint8_t* chunks = findBox(stbl,stblSize,"stco",0,&chunksSize);
+		if(chunks == NULL)
+		{
+			chunks = findBox(stbl,stblSize,"co64",0,&chunksSize);
+			offsetSize = sizeof(uint64_t);
+		}
+		if(stsz == NULL || stsc == NULL || chunks == NULL || stszSize < 12 || stscSize < 8 || chunksSize < 8)
+		{
+			continue;
+		}
+		
+		//Every table starts with a 4 byte version and flags
+		uint32_t fixedSize = boxField(&stsz[4]);
+		uint32_t trackSamples = boxField(&stsz[8]);
+		uint32_t stscCount = boxField(&stsc[4]);
+		uint32_t chunkCount = boxField(&chunks[4]);
+		uint32_t stssCount = (stss != NULL && stssSize >= 8 ? boxField(&stss[4]) : 0);
+		if((fixedSize == 0 && (stszSize-12)/sizeof(uint32_t) < trackSamples) || (stscSize-8)/(3*sizeof(uint32_t)) < stscCount || (chunksSize-8)/offsetSize < chunkCount || (stssCount != 0 && (stssSize-8)/sizeof(uint32_t) < stssCount))
+		{
+			continue;
+		}
+		
+		uint32_t sample = 0;
+		uint32_t sync = 0;//Next stss entry
+		uint32_t entry = 0;//stsc entry of the current chunk
+		for(uint32_t chunk = 0;chunk<chunkCount && sample<trackSamples && stscCount != 0;chunk++)
 		{
-			outBufferSize = BUFFER_SIZE;
-			int error = compress2(outBuffer, &outBufferSize, (Bytef *)&image[currSize], ((decompSize>(imageSize-currSize))?(imageSize-currSize):decompSize), Z_BEST_COMPRESSION);
-			if(error != Z_OK)
+			while(entry+1 < stscCount && boxField(&stsc[8+(entry+1)*3*sizeof(uint32_t)]) <= chunk+1)//stsc entries start at 1-based chunk numbers
 			{
-				switch(error)
-				{
-					case Z_MEM_ERROR:
-						printf("Compression Memory Error\n");
-						break;
-
-					case Z_BUF_ERROR:
-						printf("Compression Buffer Error\n");
-						break;
-									
-					case Z_DATA_ERROR:
-						printf("Compression Data Error\n");
-						break;
-						
-					default:
-						printf("Compression Unknown error: %d\n",error);
-						break;
-				}
-				exit(error);
+				entry++;
 			}
-			
-			if(remainingFrameSize<(outBufferSize+sizeof(outBufferSize))||((decompSize>(imageSize-currSize))?(imageSize-currSize):decompSize)==0)
+			uint32_t chunkSamples = boxField(&stsc[8+entry*3*sizeof(uint32_t)+sizeof(uint32_t)]);
+			uint64_t offset;
+			if(offsetSize == sizeof(uint32_t))
 			{
-				break;
+				offset = boxField(&chunks[8+chunk*offsetSize]);
+			}
+			else
+			{
+				offset = ((uint64_t)boxField(&chunks[8+chunk*offsetSize])<<32) | boxField(&chunks[8+chunk*offsetSize+sizeof(uint32_t)]);
 			}
 			
-			//printf("Comp Len: %lu Uncomp len: %lu\n",outBufferSize, (decompSize>(imageSize-currSize))?(imageSize-currSize):decompSize);
-			
-			memcpy(&data[headerSize+sizeof(currSize)+offset],&outBufferSize,sizeof(outBufferSize));//Compressed size of data
-			memcpy(&data[headerSize+sizeof(currSize)+sizeof(outBufferSize)+offset],outBuffer,outBufferSize);//Compressed data
-			currSize += ((decompSize>(imageSize-currSize))?(imageSize-currSize):decompSize);
-			remainingFrameSize -= outBufferSize+sizeof(outBufferSize);
-			offset += outBufferSize + sizeof(outBufferSize);
+			for(uint32_t x = 0;x<chunkSamples && sample<trackSamples;x++)
+			{
+				if(sampleCount == sampleSlots)
+				{
+					sampleSlots = (sampleSlots == 0 ? 1024 : sampleSlots*2);
+					*samples = realloc(*samples,sampleSlots*sizeof(struct mp4Sample));
+					if(*samples == NULL)
+					{
+						printf("Error! Could not allocate sample index\n");
+						exit(-1);
+					}
+				}
+				struct mp4Sample* entrySample = &(*samples)[sampleCount];
+				entrySample->offset = offset;
+				entrySample->size = (fixedSize != 0 ? fixedSize : boxField(&stsz[12+sample*sizeof(uint32_t)]));
+				
+				while(sync < stssCount && boxField(&stss[8+sync*sizeof(uint32_t)]) < sample+1)//stss lists 1-based sample numbers in order
+				{
+					sync++;
+				}
+				entrySample->key = (sync < stssCount && boxField(&stss[8+sync*sizeof(uint32_t)]) == sample+1);
+				
+				offset += entrySample->size;
+				sampleCount++;
+				sample++;
+			}
 		}
-		//printf("frame Size: %u	currSize: %u	imageSize: %u\n",BUFFER_SIZE - remainingFrameSize,currSize,imageSize);
-		send_vmac(1,0,0,data,BUFFER_SIZE-remainingFrameSize,intname,name_len);
-	} 
-
-	lodepng_state_cleanup(&state);
-	free(image);
+	}
+	
+	if(sampleCount > 0)
+	{
+		qsort(*samples,sampleCount,sizeof(struct mp4Sample),compareSamples);
+	}
+	return sampleCount;
 }
 
 /**
  *  mp4Send  - Sends specially formatted MP4 data
  *
- *  Sends 'moov' chunk data twice and 'mdat' and the file header once using the data pointer as a buffer
- *	and intname/name_len as the interest input for send_vmac.
+ *  Sends 'moov' chunk data twice(once with erasure coding on) and 'mdat' and the file header once using the data pointer as a buffer
+ *	and intname/name_len as the interest input for send_vmac. The boxes are found with one pass of indexBoxes
+ *	and read from their place in the file, moov before mdat, so files and mdat boxes over 4GB are sent as well.
+ *	mdat frames are cut at the sample boundaries indexSamples finds in moov, and keyframe data gets keyframeCopies extra copies.
+ *	With fountain coding on, mdat is sent as fountain symbols by fountainSend instead.
  *	
  *	Allows the rate to be chosen in frame rate adaptation is disabled.
  *	
@@ -331,191 +1713,233 @@ void pngSend(char fileName[],char *data,char *intname,uint16_t name_len)//NOT RE
  */
 void mp4Send(char fileName[],char *data,char *intname,uint16_t name_len, int rate)
 {
-	FILE *file = fopen(fileName, "rb");
+	struct inputMap input;
+	openInput(&input,fileName);
 	
-	if (file == NULL) 
-    {   
-		printf("Error! Could not open file\n"); 
-        exit(-1);
-    }
+	struct mp4Box* boxes;
+	uint32_t boxCount = indexBoxes(&input,&boxes);
+	struct mp4Box* moov = NULL;
+	struct mp4Box* mdat = NULL;
+	for(uint32_t x = 0;x<boxCount;x++)
+	{
+		if(moov == NULL && strcmp("moov",boxes[x].name)==0)
+		{
+			moov = &boxes[x];
+		}
+		else if(mdat == NULL && strcmp("mdat",boxes[x].name)==0 && boxes[x].size != 0)
+		{
+			mdat = &boxes[x];
+		}
+	}
+	if(moov == NULL || mdat == NULL)
+	{
+		printf("Error! No %s box in %s\n",moov == NULL ? "moov" : "mdat",fileName);
+		exit(-1);
+	}
+	if(moov->size > UINT32_MAX)
+	{
+		printf("Error! moov box too large\n");
+		exit(-1);
+	}
+	uint8_t moovFirst = (moov->offset < mdat->offset);
 	
-	char chunkName[5];
+	//Only samples in the mdat box being sent are kept, with their offsets moved into the box contents
+	struct mp4Sample* samples;
+	uint32_t sampleCount = indexSamples(mapInput(&input,moov->offset+moov->headerSize,moov->size),moov->size,&samples);
+	uint64_t mdatStart = mdat->offset+mdat->headerSize;
+	uint32_t mdatSamples = 0;
+	for(uint32_t x = 0;x<sampleCount;x++)
+	{
+		if(samples[x].offset >= mdatStart && samples[x].offset-mdatStart < mdat->size)
+		{
+			samples[mdatSamples] = samples[x];
+			samples[mdatSamples].offset -= mdatStart;
+			if(samples[mdatSamples].size > mdat->size-samples[mdatSamples].offset)
+			{
+				samples[mdatSamples].size = mdat->size-samples[mdatSamples].offset;
+			}
+			mdatSamples++;
+		}
+	}
 	
 	uint16_t headerSize = 0;
 	memcpy(&data[headerSize],"MP4",3);//Sets beginning of every frame to be MP4
-	headerSize += 3;
-	
-	uint32_t fchunkSize;//mp4 file chunk size
-	fread(&fchunkSize,sizeof(fchunkSize),1,file);
-	fchunkSize = changeEndian(fchunkSize);
-
-	fread(chunkName,4,1,file);
-	chunkName[4] = '\0';
+	headerSize += FRAME_HEADER_SIZE;
 	
 	char* headerData = malloc(0);
 	uint16_t fileHeaderSize = 0;
-	if(strcmp("ftyp",chunkName)==0)
+	if(boxCount > 0 && strcmp("ftyp",boxes[0].name)==0 && boxes[0].headerSize == sizeof(uint32_t)+4 && boxes[0].headerSize+boxes[0].size <= BUFFER_SIZE/2)//Copied as the frames it goes in are built after the mapping has moved on
 	{
-		headerData = realloc(headerData,fchunkSize);
-		fileHeaderSize = fchunkSize;
-		
-		fseek(file,-4-sizeof(fchunkSize),SEEK_CUR);
-		fread(headerData,fchunkSize,1,file);
+		fileHeaderSize = boxes[0].headerSize+boxes[0].size;
+		headerData = realloc(headerData,fileHeaderSize);
+		memcpy(headerData,mapInput(&input,0,fileHeaderSize),fileHeaderSize);
 	}
-	else
-	{
-		fseek(file,0,SEEK_SET);
-	}		
 	
-	long int dataStartPos = ftell(file);
-	
-	uint16_t dataLen;
-	int16_t remainingFrameSize = BUFFER_SIZE;
-	uint32_t tempSize;
+	int16_t remainingFrameSize = frameSize;
 	uLongf outBufferSize;
-	uint32_t currSize = 0;//Amount of data sent so far
+	uint64_t currSize = 0;//Amount of data sent so far
+	
+	//moov//
+	uint32_t moovSize = moov->size;
+	uint32_t subSeq = 0;
+	memcpy(&data[headerSize],&moov->size,sizeof(moov->size));
+	memcpy(&data[headerSize+sizeof(moov->size)],"moov",4);
+	headerSize += sizeof(moov->size) + 4;
+	
+	memcpy(&data[headerSize],&moovFirst,sizeof(moovFirst));
+	headerSize += sizeof(moovFirst);
+	
+	memcpy(&data[headerSize],headerData,fileHeaderSize);
+	headerSize += fileHeaderSize;
+	
+	uint16_t subSeqPos = headerSize;
+	headerSize += sizeof(subSeq);
+	
+	data[headerSize] = payloadCodec;
+	headerSize += 1;
+	
+	//With erasure coding on, parity frames protect moov in place of the second copy. The number of copies is sent so the
+	//receiver's loss figure does not depend on whether any parity frame arrived
+	uint8_t moovCopies = (fecData != 0 ? 1 : 2);
+	data[headerSize] = moovCopies;
+	headerSize += sizeof(moovCopies);
+	
+	uint16_t segmentPos = headerSize;
+	headerSize += 2*sizeof(uint32_t);
 	
-	uint8_t mdatRead = 0;
-	uint8_t moovRead = 0;
-	uint8_t moovFirst = 1;
-	while(mdatRead != 1 || moovRead != 1)
+	//moov is compressed MOOV_SEGMENT bytes at a time as independent streams, so a lost segment costs only its own bytes and
+	//memory is bounded by one segment. Segments are compressed again for the second copy rather than held for the whole box.
+	outBufferSize = codecBound(payloadCodec,MOOV_SEGMENT);
+	Bytef* compTemp = malloc(outBufferSize);
+	if(compTemp == NULL)
 	{
-		fseek(file,dataStartPos,SEEK_SET);
-		while(fread(&fchunkSize,sizeof(fchunkSize),1,file))
+		printf("Error! Could not allocate moov buffer\n");
+		exit(-1);
+	}
+	
+	for(int x = 0;x<moovCopies;x++)
+	{
+		subSeq = 0;
+		for(uint32_t segment = 0;(uint64_t)segment*MOOV_SEGMENT<moovSize;segment++)
 		{
-			fread(chunkName,4,1,file);
-			fchunkSize = changeEndian(fchunkSize);
-			fchunkSize -= sizeof(fchunkSize)+4;
-			if(strcmp("mdat",chunkName)==0 && fchunkSize!=0 && mdatRead!=1 && moovRead != 1)
+			uint32_t segmentLen = (moovSize-segment*MOOV_SEGMENT < MOOV_SEGMENT ? moovSize-segment*MOOV_SEGMENT : MOOV_SEGMENT);
+			uint32_t compLen = codecCompress(payloadCodec,mapInput(&input,moov->offset+moov->headerSize+segment*MOOV_SEGMENT,segmentLen),segmentLen,compTemp,outBufferSize);//Compressed straight from the mapped file
+			if(compLen == 0)
 			{
-				moovFirst = 0;
+				printf("Compression Buffer Error\n");
+				exit(Z_BUF_ERROR);
 			}
-			if(strcmp("mdat",chunkName)==0 && fchunkSize!=0 && mdatRead!=1 && moovRead == 1)
-			{	
-				//printf("mdat found\n");
-				tempSize = fchunkSize + sizeof(fchunkSize) + 4;
-				tempSize = changeEndian(tempSize);
-				
-				memcpy(&data[headerSize], &tempSize, sizeof(fchunkSize));
-				
-				memcpy(&data[headerSize+sizeof(fchunkSize)], "mdat", 4);
-				headerSize += 4+sizeof(currSize) + sizeof(fchunkSize);
+			memcpy(&data[segmentPos],&segment,sizeof(segment));
+			memcpy(&data[segmentPos+sizeof(segment)],&compLen,sizeof(compLen));
+			
+			currSize = 0;
+			while(compLen>currSize)
+			{
+				remainingFrameSize = frameSize-headerSize;
 				
-				currSize = 0;
+				uint16_t frameDataLeft = (remainingFrameSize<compLen-currSize?remainingFrameSize:compLen-currSize);
+				memcpy(&data[headerSize],&compTemp[currSize],frameDataLeft);
 				
-				int count = 0;
-				while(fchunkSize>currSize)
-				{
-					remainingFrameSize = BUFFER_SIZE-headerSize;
-					memcpy(&data[headerSize-sizeof(currSize)],&currSize,sizeof(currSize));
-					//printf("Curr size: %u chunkSize: %u\n",currSize,fchunkSize);
-					
-					if(fchunkSize-currSize>remainingFrameSize)
-					{
-						fread(&data[headerSize],remainingFrameSize,1,file);
-						dataLen = remainingFrameSize;
-					}
-					else
-					{
-						fread(&data[headerSize],fchunkSize-currSize,1,file);
-						dataLen = fchunkSize-currSize;
-					}
-					
-					currSize += dataLen;
-					remainingFrameSize -= dataLen;
-					
-					send_vmac(1,rate,0,data,BUFFER_SIZE-remainingFrameSize,intname,name_len);
-					count++;
-				}
+				currSize += frameDataLeft;
+				remainingFrameSize -= frameDataLeft;
 				
-				//printf("count: %d",count);
-
-				headerSize -= 4+sizeof(currSize)+sizeof(fchunkSize);
-				mdatRead = 1;
-				break;
+				memcpy(&data[subSeqPos],&subSeq,sizeof(subSeq));
+				sendFrame(data,frameSize-remainingFrameSize,rate,intname,name_len);
+				subSeq += 1;
 			}
-			else if(strcmp("moov",chunkName)==0 && mdatRead != 1 && moovRead != 1)
+		}
+	}
+	free(compTemp);
+	
+	headerSize -= sizeof(moov->size) + 4 + sizeof(subSeq) + 1 + sizeof(moovCopies) + 2*sizeof(uint32_t) + fileHeaderSize + sizeof(moovFirst);
+	
+	//mdat//
+	memcpy(&data[headerSize],&mdat->size,sizeof(mdat->size));
+	memcpy(&data[headerSize+sizeof(mdat->size)],"mdat",4);
+	headerSize += sizeof(mdat->size) + 4 + sizeof(currSize);
+	
+	if(fountainOverhead != 0)
+	{
+		struct fountainSource source = {.input = &input, .start = mdatStart, .size = mdat->size, .header = data, .headerSize = headerSize,
+			.offsetPos = headerSize-sizeof(currSize), .lengthPos = 0, .dataSize = FOUNTAIN_FRAME_MAX-headerSize};
+		fountainSend(&source,rate,intname,name_len);
+	}
+	else
+	{
+		//mdat is sent straight from the mapped file, SEND_BATCH frames at a time each with its own copy of the header.
+		//A frame ends early rather than split a sample that would fit in the next one, so a lost frame damages as few samples
+		//as possible. Frames holding keyframe data are sent keyframeCopies more times after their batch
+		struct frameParts batch[SEND_BATCH];
+		struct frameParts keyBatch[SEND_BATCH];
+		uint64_t frameOffset[SEND_BATCH];//Offset in the mdat box contents of each frame in the batch
+		char* batchHeaders = malloc((size_t)SEND_BATCH*headerSize);
+		if(batchHeaders == NULL)
+		{
+			printf("Error! Could not allocate frame headers\n");
+			exit(-1);
+		}
+		uint16_t frameDataMax = frameSize-headerSize;
+		uint32_t sample = 0;//First sample not wholly sent
+		currSize = 0;
+		while(mdat->size>currSize)
+		{
+			uint64_t batchStart = currSize;
+			int count = 0;
+			int keyCount = 0;
+			uint8_t key[SEND_BATCH];
+			while(count < SEND_BATCH && mdat->size>currSize)
 			{
-				//printf("moov found\n");
-				
-				currSize = 0;
-				uint32_t subSeq = 0;
-				tempSize = changeEndian(fchunkSize + sizeof(fchunkSize) + 4);
-				memcpy(&data[headerSize], &tempSize,sizeof(fchunkSize));
-				memcpy(&data[headerSize+sizeof(fchunkSize)],"moov",4);
-				headerSize += 4 + sizeof(fchunkSize);
-				
-				memcpy(&data[headerSize],&moovFirst,sizeof(moovFirst));
-				headerSize += sizeof(moovFirst);
-				
-				memcpy(&data[headerSize],headerData,fileHeaderSize);
-				headerSize += fileHeaderSize;
-				
-				headerSize += sizeof(subSeq);
-				
-				outBufferSize = compressBound(fchunkSize);
-				Bytef* compTemp = malloc(outBufferSize);
-				Bytef* temp = malloc(fchunkSize);
-				
-				fread(temp,fchunkSize,1,file);
-				
-				int error = compress2(compTemp, &outBufferSize, temp, fchunkSize, Z_BEST_COMPRESSION);
-				if(error != Z_OK)
+				uint64_t end = (mdat->size-currSize < frameDataMax ? mdat->size : currSize+frameDataMax);
+				while(sample<mdatSamples && samples[sample].offset+samples[sample].size <= currSize)
+				{
+					sample++;
+				}
+				key[count] = 0;
+				for(uint32_t x = sample;x<mdatSamples && samples[x].offset<end;x++)
 				{
-					switch(error)
+					if(samples[x].offset > currSize && samples[x].offset+samples[x].size > end && samples[x].size <= frameDataMax)
 					{
-						case Z_MEM_ERROR:
-							printf("Compression Memory Error\n");
-							break;
-
-						case Z_BUF_ERROR:
-							printf("Compression Buffer Error\n");
-							break;
-										
-						case Z_DATA_ERROR:
-							printf("Compression Data Error\n");
-							break;
-							
-						default:
-							printf("Compression Unknown error: %d\n",error);
-							break;
+						end = samples[x].offset;
+						break;
 					}
-					exit(error);
+					key[count] |= samples[x].key;
 				}
-				free(temp);			
 				
+				char* header = &batchHeaders[count*headerSize];
+				memcpy(header,data,headerSize);
+				memcpy(&header[headerSize-sizeof(currSize)],&currSize,sizeof(currSize));
 				
-				for(int x = 0;x<2;x++)
+				frameOffset[count] = currSize;
+				batch[count].header.iov_base = header;
+				batch[count].header.iov_len = headerSize;
+				batch[count].payloadLen = end-currSize;
+				count++;
+				currSize = end;
+			}
+			
+			const uint8_t* in = mapInput(&input,mdatStart+batchStart,currSize-batchStart);
+			for(int x = 0;x<count;x++)
+			{
+				batch[x].payload = &in[frameOffset[x]-batchStart];
+				if(key[x])
 				{
-					subSeq = 0;
-					currSize = 0;
-					while(outBufferSize>currSize)
-					{
-						remainingFrameSize = BUFFER_SIZE-headerSize;
-						
-						uint16_t frameDataLeft = (remainingFrameSize<outBufferSize-currSize?remainingFrameSize:outBufferSize-currSize);
-						memcpy(&data[headerSize],&compTemp[currSize],frameDataLeft);
-						
-						currSize += frameDataLeft;
-						remainingFrameSize -= frameDataLeft;
-						
-						memcpy(&data[headerSize-sizeof(subSeq)],&subSeq,sizeof(subSeq));
-						send_vmac(1,rate,0,data,BUFFER_SIZE-remainingFrameSize,intname,name_len);
-						subSeq += 1;
-					}
+					keyBatch[keyCount] = batch[x];
+					keyCount++;
 				}
-				free(compTemp);
-				
-				headerSize -= 4 + sizeof(fchunkSize) + sizeof(subSeq) + fileHeaderSize + sizeof(moovFirst);
-				//printf("Sub seq: %u",subSeq-1);
-				moovRead = 1;
 			}
-			else
+			
+			sendFrames(batch,count,rate,intname,name_len);
+			for(int x = 0;x<keyframeCopies;x++)
 			{
-				fseek(file,fchunkSize,SEEK_CUR);
+				sendFrames(keyBatch,keyCount,rate,intname,name_len);
 			}
 		}
+		free(batchHeaders);
+		flushParity(rate,intname,name_len);
 	}
+	
+	free(samples);
+	free(boxes);
 	free(headerData);
-	fclose(file);
-}
\ No newline at end of file
+	closeInput(&input);
+}